@@ -0,0 +1,91 @@
+#pragma once
+
+#include "BenchmarkRunner.h"
+
+#include "BatchCodec.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+// Compression ratio and CPU cost of the batched uplink codec
+namespace benchmark
+{
+
+// Minute samples shaped like the outdoor records: slow daily drift of PTH with the sensor noise,
+// PM values refreshed hourly, the wake time jittering by a few milliseconds
+inline void makeSyntheticSeries(BatchCodec::Sample* samples, size_t count)
+{
+    uint32_t random = 12345;
+    auto noise = [&random](int amplitude) {
+        random = random * 1103515245u + 12345u;
+        return static_cast<int>((random >> 16) % (2 * amplitude + 1)) - amplitude;
+    };
+    int16_t pm25 = 12;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto phase = 2 * 3.14159265358979 * static_cast<double>(i) / (24 * 60);
+        if (i % 60 == 0)
+        {
+            pm25 = static_cast<int16_t>(std::max(1, pm25 + noise(3)));
+        }
+        samples[i].timestampMilliseconds = 1692025000000ll + 60000ll * i + 450 + noise(20);
+        samples[i].data = MeasurementData {
+                static_cast<int32_t>(std::lround((65 - 15 * std::sin(phase) + noise(40) / 1024.0) * FixedPoint::humidityScale)),
+                static_cast<int32_t>(std::lround((12 + 6 * std::sin(phase) + noise(3) / 100.0) * FixedPoint::temperatureScale)),
+                static_cast<int32_t>(std::lround((101325 + 150 * std::sin(phase / 2) + noise(300) / 256.0) * FixedPoint::pressureScale)),
+                static_cast<int16_t>(pm25 * 2 / 3), pm25, static_cast<int16_t>(pm25 + 4),
+                static_cast<int32_t>(std::lround((3.95 - 0.0001 * i + noise(3) / 1000.0) * FixedPoint::voltageScale)), 0 };
+    }
+}
+
+template<typename Runner>
+void runBatchCodecBenchmarks(Runner& runner, const BatchCodec::Sample* samples, size_t count)
+{
+    constexpr std::array<std::pair<BatchCodec::Options, const char*>, 2> variants {{
+            { BatchCodec::Options::FixedPoint, "fixed_point" },
+            { BatchCodec::Options::XorFloat, "xor_float" },
+    }};
+    std::array<uint8_t, BatchCodec::maxFrameSize> frame {};
+    std::array<BatchCodec::Sample, BatchCodec::maxSamples> decoded {};
+    char name[48];
+    for (const auto& [options, variant] : variants)
+    {
+        size_t frames = 0;
+        size_t bytes = 0;
+        for (size_t offset = 0; offset < count; ++frames)
+        {
+            size_t size = 0;
+            const auto encoded = BatchCodec::encode(samples + offset, count - offset, options, frame.data(), frame.size(), size);
+            if (encoded == 0)
+            {
+                return;
+            }
+            offset += encoded;
+            bytes += size;
+        }
+        snprintf(name, sizeof(name), "batch_%s", variant);
+        runner.value(name, "samples_per_frame", static_cast<double>(count) / frames);
+        // Against one MeasurementMessage per sample
+        runner.value(name, "compression_ratio", static_cast<double>(count * sizeof(MeasurementMessage)) / bytes);
+
+        size_t frameSize = 0;
+        const auto frameSamples = BatchCodec::encode(samples, count, options, frame.data(), frame.size(), frameSize);
+        snprintf(name, sizeof(name), "batch_encode_%s", variant);
+        runner.run(name, 1000, [&]() {
+            size_t size = 0;
+            auto encoded = BatchCodec::encode(samples, count, options, frame.data(), frame.size(), size);
+            doNotOptimize(encoded);
+        });
+        BatchCodec::encode(samples, frameSamples, options, frame.data(), frame.size(), frameSize);
+        snprintf(name, sizeof(name), "batch_decode_%s", variant);
+        runner.run(name, 1000, [&]() {
+            auto samplesDecoded = BatchCodec::decode(frame.data(), frameSize, decoded.data(), decoded.size());
+            doNotOptimize(samplesDecoded);
+        });
+    }
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+// Minimal benchmark harness shared by the host and the on-target benchmarks.
+// Every result is printed as one JSON line prefixed with "BENCH", see tools/compare_benchmarks.py.
+namespace benchmark
+{
+
+template<typename T>
+inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// Clock shall provide static nanoseconds() and cycles() functions and the hasCycles constant
+template<typename Clock>
+class Runner
+{
+public:
+    explicit Runner(const char* platform) : platform(platform) {}
+
+    template<typename Operation>
+    void run(const char* name, uint32_t iterations, Operation&& operation)
+    {
+        for (uint32_t i = 0; i < iterations / 10; ++i)
+        {
+            operation();
+        }
+        const auto startNanoseconds = Clock::nanoseconds();
+        const auto startCycles = Clock::cycles();
+        for (uint32_t i = 0; i < iterations; ++i)
+        {
+            operation();
+        }
+        const auto cycles = static_cast<uint32_t>(Clock::cycles() - startCycles);
+        const auto nanoseconds = Clock::nanoseconds() - startNanoseconds;
+        printf("BENCH {\"kind\":\"micro\",\"platform\":\"%s\",\"name\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.1f",
+               platform, name, static_cast<unsigned>(iterations), static_cast<double>(nanoseconds) / iterations);
+        if constexpr (Clock::hasCycles)
+        {
+            printf(",\"cycles_per_op\":%.1f", static_cast<double>(cycles) / iterations);
+        }
+        printf("}\n");
+    }
+
+    // Reports a non-timing result like a compression ratio
+    void value(const char* name, const char* metric, double result)
+    {
+        printf("BENCH {\"kind\":\"value\",\"platform\":\"%s\",\"name\":\"%s\",\"%s\":%.3f}\n",
+               platform, name, metric, result);
+    }
+
+private:
+    const char* platform;
+};
+
+}
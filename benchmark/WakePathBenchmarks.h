@@ -0,0 +1,158 @@
+#pragma once
+
+#include "BenchmarkRunner.h"
+
+#include "FixedPoint.h"
+#include "MeasurementMessage.h"
+#include "TimeFunctions.h"
+
+#include <cstring>
+#include <string_view>
+
+// Benchmarks of the wake-path code which doesn't depend on the hardware
+namespace benchmark
+{
+
+// The sensor readings of one wake as the drivers return them
+struct SensorRegisters
+{
+    // BME280 compensation: 0.01 °C, Pa Q24.8, % Q22.10
+    int32_t temperature = 2125;
+    uint32_t pressure = 101325 * 256;
+    uint32_t humidity = 45 * 1024;
+    int voltageRaw = 2941;
+    // SPS30 firmware 1.x big-endian float bits of PM1.0, PM2.5 and PM10
+    uint32_t pmBits[3] = { 0x40400000, 0x40a00000, 0x40e00000 };
+
+    void next()
+    {
+        ++temperature;
+        pressure += 37;
+        humidity += 11;
+        voltageRaw = (voltageRaw + 1) & 0xfff;
+        pmBits[1] ^= 0x100;
+    }
+};
+
+// The same data path with the float arithmetic the firmware used and with the fixed-point one:
+// BME280 results, battery ADC reading and SPS30 concentrations up to the packed measurement message
+template<typename Runner>
+void runDataPathBenchmarks(Runner& runner)
+{
+    constexpr std::string_view serial = "0123456789ABCDEF";
+    constexpr float rawToVolts = 3.3f / 4095;
+    // Runtime constants like the AppConfig values
+    volatile float batteryVoltageDivider = 0.6f;
+    volatile uint32_t millivoltsPerCount = 88000;
+    SensorRegisters registers;
+    MeasurementPacket packet {};
+
+    runner.run("pth_convert_float", 100000, [&]() {
+        registers.next();
+        float values[3] = { static_cast<float>(registers.humidity) / 1024.f, static_cast<float>(registers.temperature) / 100.f
+                            , static_cast<float>(registers.pressure) / 256.f };
+        doNotOptimize(values);
+    });
+    runner.run("pth_convert_fixed", 100000, [&]() {
+        registers.next();
+        int32_t values[3] = { FixedPoint::fromBme280Humidity(registers.humidity)
+                              , FixedPoint::fromBme280Temperature(registers.temperature)
+                              , FixedPoint::fromBme280Pressure(registers.pressure) };
+        doNotOptimize(values);
+    });
+    runner.run("battery_convert_float", 100000, [&]() {
+        registers.next();
+        float volts = static_cast<float>(registers.voltageRaw) * rawToVolts / batteryVoltageDivider;
+        doNotOptimize(volts);
+    });
+    runner.run("battery_convert_fixed", 100000, [&]() {
+        registers.next();
+        auto millivolts = FixedPoint::millivoltsFromRaw(registers.voltageRaw, millivoltsPerCount);
+        doNotOptimize(millivolts);
+    });
+    runner.run("sps30_decode_float", 100000, [&]() {
+        registers.next();
+        uint16_t pm[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            float value;
+            memcpy(&value, &registers.pmBits[i], sizeof(value));
+            pm[i] = static_cast<uint16_t>(value);
+        }
+        doNotOptimize(pm);
+    });
+    runner.run("sps30_decode_fixed", 100000, [&]() {
+        registers.next();
+        uint16_t pm[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            pm[i] = FixedPoint::uint16FromFloatBits(registers.pmBits[i]);
+        }
+        doNotOptimize(pm);
+    });
+
+    runner.run("data_path_float", 100000, [&]() {
+        registers.next();
+        float pm[3];
+        memcpy(pm, registers.pmBits, sizeof(pm));
+        auto& message = packet.message;
+        memcpy(message.spsSerial, serial.data(), serial.size());
+        message.pm01 = static_cast<int16_t>(static_cast<uint16_t>(pm[0]));
+        message.pm25 = static_cast<int16_t>(static_cast<uint16_t>(pm[1]));
+        message.pm10 = static_cast<int16_t>(static_cast<uint16_t>(pm[2]));
+        message.humidity.real = static_cast<float>(registers.humidity) / 1024.f;
+        message.temperature.real = static_cast<float>(registers.temperature) / 100.f;
+        message.pressure.real = static_cast<float>(registers.pressure) / 256.f;
+        message.voltage.real = static_cast<float>(registers.voltageRaw) * rawToVolts / batteryVoltageDivider;
+        message.flags = 0;
+        doNotOptimize(packet);
+    });
+    runner.run("data_path_fixed", 100000, [&]() {
+        registers.next();
+        const MeasurementData data {
+                FixedPoint::fromBme280Humidity(registers.humidity), FixedPoint::fromBme280Temperature(registers.temperature)
+                , FixedPoint::fromBme280Pressure(registers.pressure)
+                , static_cast<int16_t>(FixedPoint::uint16FromFloatBits(registers.pmBits[0]))
+                , static_cast<int16_t>(FixedPoint::uint16FromFloatBits(registers.pmBits[1]))
+                , static_cast<int16_t>(FixedPoint::uint16FromFloatBits(registers.pmBits[2]))
+                , FixedPoint::millivoltsFromRaw(registers.voltageRaw, millivoltsPerCount), 0 };
+        packMeasurement(packet, data, serial, true);
+        doNotOptimize(packet);
+    });
+}
+
+template<typename Runner>
+void runWakePathBenchmarks(Runner& runner)
+{
+    constexpr std::string_view serial = "0123456789ABCDEF";
+    MeasurementData data { 4550, 2125, 1013250, 3, 5, 7, 3950, 0 };
+    MeasurementPacket packet {};
+    runner.run("message_pack_float", 100000, [&]() {
+        data.pm01 = static_cast<int16_t>(data.pm01 + 1);
+        packMeasurement(packet, data, serial, false);
+        doNotOptimize(packet);
+    });
+    runner.run("message_pack_fixed", 100000, [&]() {
+        data.pm01 = static_cast<int16_t>(data.pm01 + 1);
+        packMeasurement(packet, data, serial, true);
+        doNotOptimize(packet);
+    });
+
+    runDataPathBenchmarks(runner);
+
+    int64_t now = 1692025000ll * microsecondsInSecond;
+    runner.run("sleep_till_next_minute", 100000, [&]() {
+        now += 1234567;
+        auto sleepTime = sleepMicrosecondsTillNextMinute(now, 450000);
+        doNotOptimize(sleepTime);
+    });
+
+    timeval tv { 1692025000, 0 };
+    runner.run("microseconds_from_timeval", 100000, [&]() {
+        ++tv.tv_usec;
+        auto microseconds = microsecondsFromTimeval(tv);
+        doNotOptimize(microseconds);
+    });
+}
+
+}
@@ -0,0 +1,78 @@
+#include "WakePathBenchmarks.h"
+#include "BatchCodecBenchmarks.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+struct HostClock
+{
+    static constexpr bool hasCycles = false;
+    static int64_t nanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static uint32_t cycles() { return 0; }
+};
+
+// CSV records exported from the indoor unit:
+// timestamp_ms,humidity,temperature,pressure,pm01,pm25,pm10,voltage,flags
+std::vector<BatchCodec::Sample> loadSamples(const char* path)
+{
+    std::vector<BatchCodec::Sample> samples;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        perror(path);
+        return samples;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        BatchCodec::Sample sample {};
+        long long timestamp;
+        double humidity, temperature, pressure, voltage;
+        int pm01, pm25, pm10;
+        unsigned flags;
+        if (sscanf(line, "%lld,%lf,%lf,%lf,%d,%d,%d,%lf,%u", &timestamp, &humidity, &temperature, &pressure, &pm01, &pm25
+                   , &pm10, &voltage, &flags) == 9)
+        {
+            sample.timestampMilliseconds = timestamp;
+            sample.data.humidity = static_cast<int32_t>(std::lround(humidity * FixedPoint::humidityScale));
+            sample.data.temperature = static_cast<int32_t>(std::lround(temperature * FixedPoint::temperatureScale));
+            sample.data.pressure = static_cast<int32_t>(std::lround(pressure * FixedPoint::pressureScale));
+            sample.data.batteryVoltage = static_cast<int32_t>(std::lround(voltage * FixedPoint::voltageScale));
+            sample.data.pm01 = static_cast<int16_t>(pm01);
+            sample.data.pm25 = static_cast<int16_t>(pm25);
+            sample.data.pm10 = static_cast<int16_t>(pm10);
+            sample.data.flags = flags;
+            samples.push_back(sample);
+        }
+    }
+    fclose(file);
+    return samples;
+}
+}
+
+// Usage: wake_benchmarks [recorded_samples.csv]
+int main(int argc, char* argv[])
+{
+    benchmark::Runner<HostClock> runner("host");
+    benchmark::runWakePathBenchmarks(runner);
+
+    std::vector<BatchCodec::Sample> samples;
+    if (argc > 1)
+    {
+        samples = loadSamples(argv[1]);
+    }
+    else
+    {
+        samples.resize(24 * 60);
+        benchmark::makeSyntheticSeries(samples.data(), samples.size());
+    }
+    benchmark::runBatchCodecBenchmarks(runner, samples.data(), samples.size());
+    return 0;
+}
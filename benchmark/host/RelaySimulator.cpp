@@ -0,0 +1,155 @@
+#include "BenchmarkRunner.h"
+
+#include "RouteSelector.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// Multi-node radio simulation of the relay routing.
+// Battery units exchange a record with the indoor unit every minute, either directly or through one relay
+// powered over USB, each link losing a frame with its own probability in both directions. The exchange follows
+// EspNowTransport: an attempt is acknowledged by the MAC layer, then the time correction is awaited; up to
+// maxAttempts attempts, switching to the next best route at routeFallbackAttempt. The route is chosen by the
+// firmware RouteSelector. The relay forwards its queue to the indoor unit once a minute.
+// Every unit runs twice, with the direct route only and with the relay configured.
+namespace
+{
+// As in EspNowTransport
+constexpr int maxAttempts = 10;
+constexpr int routeFallbackAttempt = 5;
+constexpr int relayForwardAttempts = 3;
+
+constexpr int minutes = 3 * 24 * 60;
+
+struct Unit
+{
+    const char* name;
+    double directLoss;
+    double relayLoss;
+    // The direct link changes its quality after a day, like a parked car moving away
+    double laterDirectLoss;
+};
+
+struct Result
+{
+    int delivered = 0;
+    int attempts = 0;
+    int completed = 0;
+};
+
+struct HostClock
+{
+    static constexpr bool hasCycles = false;
+    static int64_t nanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static uint32_t cycles() { return 0; }
+};
+
+class Radio
+{
+public:
+    explicit Radio(uint32_t seed) : generator(seed) {}
+    bool passes(double loss) { return distribution(generator) >= loss; }
+private:
+    std::mt19937 generator;
+    std::uniform_real_distribution<double> distribution {0.0, 1.0};
+};
+
+Result simulate(const Unit& unit, bool withRelay, double relayIndoorLoss, uint32_t seed)
+{
+    Radio radio(seed);
+    RouteSelector router(withRelay ? 2 : 1);
+    Result result;
+    std::set<int> indoorRecords;
+    std::vector<int> relayQueue;
+
+    for (int minute = 0; minute < minutes; ++minute)
+    {
+        const double directLoss = minute < 24 * 60 ? unit.directLoss : unit.laterDirectLoss;
+        auto route = router.select();
+        int routeAttempts = 0;
+        bool completed = false;
+        for (int attempt = 0; attempt < maxAttempts && !completed; ++attempt)
+        {
+            if (attempt == routeFallbackAttempt)
+            {
+                if (const auto next = router.alternative(route); next != route)
+                {
+                    router.onExchange(route, false, routeAttempts);
+                    route = next;
+                    routeAttempts = 0;
+                }
+            }
+            ++routeAttempts;
+            ++result.attempts;
+            const double loss = route == RouteSelector::directRoute ? directLoss : unit.relayLoss;
+            if (!radio.passes(loss))
+            {
+                continue;
+            }
+            // The peer has the record even if the acknowledgement is lost and the sender retries
+            if (route == RouteSelector::directRoute)
+            {
+                indoorRecords.insert(minute);
+            }
+            else if (relayQueue.empty() || relayQueue.back() != minute)
+            {
+                relayQueue.push_back(minute);
+            }
+            if (!radio.passes(loss))
+            {
+                continue;
+            }
+            // Acknowledged, no more attempts: the exchange completes only if the correction comes through
+            completed = radio.passes(loss);
+            break;
+        }
+        router.onExchange(route, completed, routeAttempts);
+        result.completed += completed ? 1 : 0;
+
+        for (int attempt = 0; attempt < relayForwardAttempts && !relayQueue.empty(); ++attempt)
+        {
+            if (radio.passes(relayIndoorLoss))
+            {
+                indoorRecords.insert(relayQueue.begin(), relayQueue.end());
+                relayQueue.clear();
+            }
+        }
+    }
+    result.delivered = static_cast<int>(indoorRecords.size());
+    return result;
+}
+} // namespace
+
+// Usage: relay_simulator [relay_to_indoor_loss]
+int main(int argc, char* argv[])
+{
+    const double relayIndoorLoss = argc > 1 ? std::atof(argv[1]) : 0.05;
+    const std::vector<Unit> units {
+            { "near", 0.05, 0.3, 0.05 },
+            { "far", 0.85, 0.1, 0.85 },
+            { "edge", 0.6, 0.15, 0.1 },
+            { "lost", 0.95, 0.95, 0.95 },
+    };
+    benchmark::Runner<HostClock> runner("host");
+    uint32_t seed = 1;
+    for (const auto& unit : units)
+    {
+        for (const bool withRelay : { false, true })
+        {
+            const auto result = simulate(unit, withRelay, relayIndoorLoss, seed++);
+            const auto name = std::string("relay_sim/") + unit.name + (withRelay ? "/routed" : "/direct");
+            runner.value(name.c_str(), "delivery_ratio", static_cast<double>(result.delivered) / minutes);
+            runner.value(name.c_str(), "attempts_per_record", static_cast<double>(result.attempts) / minutes);
+            runner.value(name.c_str(), "completed_ratio", static_cast<double>(result.completed) / minutes);
+        }
+    }
+    return 0;
+}
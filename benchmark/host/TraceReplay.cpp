@@ -0,0 +1,320 @@
+#include "BenchmarkRunner.h"
+
+#include "SensorTrace.h"
+#include "WakeSchedule.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// Deterministic replay of a sensor trace through the battery wake schedule.
+// The trace is the ground truth: every reading it has is what the indoor unit would show with unlimited energy.
+// The replay wakes the unit when WakeScheduler plans it with the firmware job table of WakeSchedule.h, takes the
+// readings from the trace at those times and the outcomes of the exchanges from the Link records of the trace
+// in their order. The indoor unit shows the last delivered record until the next one, and the
+// difference from the trace is the fidelity; radio attempts, sensor time and the estimated charge are the cost.
+// Schedule variants stretch the periods of the firmware jobs to show what a lower rate would cost in fidelity.
+namespace
+{
+using SensorTrace::Record;
+
+// Rough charge of the wake steps of an ESP32-C3 unit, mA * s
+constexpr double sleepMilliamps = 0.04;
+constexpr double wakeCharge = 5.0;
+constexpr double pthCharge = 0.3;
+constexpr double exchangeCharge = 8.0;
+constexpr double attemptCharge = 1.5;
+constexpr double sps30Milliamps = 60.0;
+// The start and the shutdown of the SPS30 on top of the measurement time
+constexpr int sps30OverheadSeconds = 2;
+constexpr int fanCleaningSeconds = 10;
+
+struct HostClock
+{
+    static constexpr bool hasCycles = false;
+    static int64_t nanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static uint32_t cycles() { return 0; }
+};
+
+struct Reading
+{
+    int64_t milliseconds;
+    double values[3];
+};
+
+struct Trace
+{
+    // Temperature °C, humidity %, pressure hPa
+    std::vector<Reading> pth;
+    // PM1.0, PM2.5, PM10 µg/m³
+    std::vector<Reading> pm;
+    std::vector<Record> links;
+};
+
+struct Variant
+{
+    const char* name;
+    int sendEveryMinutes;
+    int pmEveryHours;
+};
+
+struct Delivered
+{
+    int64_t milliseconds;
+    double pth[3];
+    double pm25;
+};
+
+struct Result
+{
+    double pthRms[3] = {};
+    double pm25Rms = 0;
+    double pm25Max = 0;
+    int exchanges = 0;
+    int delivered = 0;
+    int attempts = 0;
+    int wakes = 0;
+    int pthMeasurements = 0;
+    int sps30Seconds = 0;
+    double chargeMilliampSeconds = 0;
+};
+
+int64_t millisecondsOf(const Record& record)
+{
+    return static_cast<int64_t>(record.seconds) * 1000 + record.milliseconds;
+}
+
+Trace loadTrace(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    const std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    Trace trace;
+    for (size_t offset = 0; offset + sizeof(Record) <= data.size(); offset += sizeof(Record))
+    {
+        Record record;
+        memcpy(&record, data.data() + offset, sizeof(record));
+        if (record.kind == SensorTrace::Kind::Pth && record.status == SensorTrace::valid)
+        {
+            trace.pth.push_back({ millisecondsOf(record), { record.values[0] / 100.0, record.values[2] / 1024.0
+                                                           , record.values[1] / 25600.0 } });
+        }
+        else if (record.kind == SensorTrace::Kind::Pm && record.status == SensorTrace::valid)
+        {
+            trace.pm.push_back({ millisecondsOf(record), { double(record.values[0]), double(record.values[1])
+                                                          , double(record.values[2]) } });
+        }
+        else if (record.kind == SensorTrace::Kind::Link)
+        {
+            trace.links.push_back(record);
+        }
+    }
+    return trace;
+}
+
+// A day of streaming capture: readings every 10 s and one exchange a minute over a link losing 20% of the frames
+Trace syntheticTrace()
+{
+    std::mt19937 generator(42);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    std::uniform_real_distribution<double> loss(0.0, 1.0);
+    constexpr int64_t start = 1700000000;
+    Trace trace;
+    double pm25 = 8.0;
+    for (int64_t second = 0; second < 24 * 3600; second += 10)
+    {
+        const double phase = 2 * M_PI * double(second) / (24 * 3600);
+        const auto milliseconds = (start + second) * 1000;
+        trace.pth.push_back({ milliseconds, { 12.0 + 6.0 * std::sin(phase) + 0.05 * noise(generator)
+                                              , 70.0 - 15.0 * std::sin(phase) + 0.3 * noise(generator)
+                                              , 1013.0 + 2.0 * std::sin(phase / 2) + 0.02 * noise(generator) } });
+        // Slow drift with the evening heating and occasional short plumes
+        pm25 = std::max(1.0, pm25 + 0.05 * noise(generator) + (second % 3600 > 3300 && second > 17 * 3600 ? 0.4 : -0.01));
+        const double plume = loss(generator) < 0.002 ? 40.0 : 0.0;
+        trace.pm.push_back({ milliseconds, { 0.7 * (pm25 + plume), pm25 + plume, 1.3 * (pm25 + plume) } });
+        if (second % 60 == 50)
+        {
+            int attempts = 1;
+            while (attempts < 10 && loss(generator) < 0.2)
+            {
+                ++attempts;
+            }
+            const auto outcome = loss(generator) < 0.2 ? SensorTrace::LinkOutcome::Acknowledged : SensorTrace::LinkOutcome::Completed;
+            trace.links.push_back(SensorTrace::link(attempts < 10 ? outcome : SensorTrace::LinkOutcome::Lost, 0, attempts, 0));
+        }
+    }
+    return trace;
+}
+
+// The last reading taken at or before the time
+const Reading* readingAt(const std::vector<Reading>& readings, int64_t milliseconds)
+{
+    const auto next = std::upper_bound(readings.begin(), readings.end(), milliseconds,
+                                       [](int64_t time, const Reading& reading) { return time < reading.milliseconds; });
+    return next == readings.begin() ? nullptr : &*std::prev(next);
+}
+
+Result replay(const Trace& trace, const Variant& variant)
+{
+    Result result;
+    std::vector<Delivered> shown;
+    const auto first = trace.pth.front().milliseconds / 1000;
+    const auto last = trace.pth.back().milliseconds / 1000;
+    size_t nextLink = 0;
+    uint32_t pmReadoutAt = 0;
+    double pm25 = -1;
+
+    WakeScheduler scheduler;
+    auto now = static_cast<uint32_t>(first);
+    WakeSchedule::start(scheduler, now);
+    auto measurement = WakeSchedule::measurement;
+    measurement.period *= variant.sendEveryMinutes;
+    scheduler.schedule(WakeSchedule::Measurement, measurement, now, false);
+    auto pmMeasurement = WakeSchedule::pmMeasurement;
+    pmMeasurement.period *= variant.pmEveryHours;
+    scheduler.schedule(WakeSchedule::PmMeasurement, pmMeasurement, now, true);
+
+    // The wakes planned by the firmware job table, thinned out by the variant
+    for (; now != 0 && now <= last; now = scheduler.nextWake(now))
+    {
+        ++result.wakes;
+        result.chargeMilliampSeconds += wakeCharge;
+        const auto due = scheduler.collectDue(now, WakeSchedule::unlimitedBudget);
+        const auto isDue = [due](WakeScheduler::JobId job) { return (due & WakeScheduler::maskOf(job)) != 0; };
+        if (isDue(WakeSchedule::BatteryCheck))
+        {
+            scheduler.complete(WakeSchedule::BatteryCheck, now);
+        }
+        if (pmReadoutAt != 0 && pmReadoutAt <= now)
+        {
+            const auto reading = readingAt(trace.pm, int64_t(pmReadoutAt) * 1000);
+            pm25 = reading != nullptr ? reading->values[1] : -1;
+            pmReadoutAt = 0;
+            scheduler.complete(WakeSchedule::PmReadout, now);
+        }
+        if (pmReadoutAt == 0 && isDue(WakeSchedule::PmMeasurement))
+        {
+            pmReadoutAt = now + WakeSchedule::pmMeasurementSeconds;
+            result.sps30Seconds += WakeSchedule::pmMeasurementSeconds + sps30OverheadSeconds;
+            scheduler.complete(WakeSchedule::PmMeasurement, now);
+            if (isDue(WakeSchedule::FanCleaning))
+            {
+                result.sps30Seconds += fanCleaningSeconds;
+                scheduler.complete(WakeSchedule::FanCleaning, now);
+            }
+            scheduler.scheduleOnce(WakeSchedule::PmReadout, WakeSchedule::pmReadout, pmReadoutAt);
+        }
+        if (!isDue(WakeSchedule::Measurement))
+        {
+            continue;
+        }
+        scheduler.complete(WakeSchedule::Measurement, now);
+        ++result.pthMeasurements;
+        result.chargeMilliampSeconds += pthCharge;
+        const auto reading = readingAt(trace.pth, int64_t(now) * 1000);
+        ++result.exchanges;
+        auto outcome = SensorTrace::LinkOutcome::Completed;
+        int attempts = 1;
+        if (!trace.links.empty())
+        {
+            const auto& link = trace.links[nextLink++ % trace.links.size()];
+            outcome = static_cast<SensorTrace::LinkOutcome>(link.status);
+            attempts = std::max(link.values[1], 1);
+        }
+        result.attempts += attempts;
+        result.chargeMilliampSeconds += exchangeCharge + attempts * attemptCharge;
+        if (outcome != SensorTrace::LinkOutcome::Lost && reading != nullptr)
+        {
+            ++result.delivered;
+            shown.push_back({ int64_t(now) * 1000, { reading->values[0], reading->values[1], reading->values[2] }, pm25 });
+        }
+    }
+    result.chargeMilliampSeconds += result.sps30Seconds * sps30Milliamps
+                                    + sleepMilliamps * static_cast<double>(last - first);
+
+    // Every reading of the trace is compared to what the indoor unit shows at its time
+    int pthCompared = 0;
+    for (const auto& reading : trace.pth)
+    {
+        const auto current = std::upper_bound(shown.begin(), shown.end(), reading.milliseconds,
+                                              [](int64_t time, const Delivered& record) { return time < record.milliseconds; });
+        if (current == shown.begin())
+        {
+            continue;
+        }
+        ++pthCompared;
+        for (int channel = 0; channel < 3; ++channel)
+        {
+            const auto error = reading.values[channel] - std::prev(current)->pth[channel];
+            result.pthRms[channel] += error * error;
+        }
+    }
+    int pmCompared = 0;
+    for (const auto& reading : trace.pm)
+    {
+        const auto current = std::upper_bound(shown.begin(), shown.end(), reading.milliseconds,
+                                              [](int64_t time, const Delivered& record) { return time < record.milliseconds; });
+        if (current == shown.begin() || std::prev(current)->pm25 < 0)
+        {
+            continue;
+        }
+        ++pmCompared;
+        const auto error = std::abs(reading.values[1] - std::prev(current)->pm25);
+        result.pm25Rms += error * error;
+        result.pm25Max = std::max(result.pm25Max, error);
+    }
+    for (auto& rms : result.pthRms)
+    {
+        rms = pthCompared > 0 ? std::sqrt(rms / pthCompared) : 0;
+    }
+    result.pm25Rms = pmCompared > 0 ? std::sqrt(result.pm25Rms / pmCompared) : 0;
+    return result;
+}
+} // namespace
+
+// Usage: trace_replay [sensor.trace]
+int main(int argc, char* argv[])
+{
+    auto trace = argc > 1 ? loadTrace(argv[1]) : syntheticTrace();
+    if (trace.pth.size() < 2)
+    {
+        fprintf(stderr, "The trace has no PTH readings\n");
+        return 1;
+    }
+    const std::vector<Variant> variants {
+            { "firmware", 1, 1 },
+            { "send_2min", 2, 1 },
+            { "send_5min", 5, 1 },
+            { "pm_3h", 1, 3 },
+            { "send_5min_pm_3h", 5, 3 },
+    };
+    benchmark::Runner<HostClock> runner("host");
+    const double days = double(trace.pth.back().milliseconds - trace.pth.front().milliseconds) / (24 * 3600 * 1000.0);
+    for (const auto& variant : variants)
+    {
+        const auto result = replay(trace, variant);
+        const auto name = std::string("trace_replay/") + variant.name;
+        runner.value(name.c_str(), "temperature_rms", result.pthRms[0]);
+        runner.value(name.c_str(), "humidity_rms", result.pthRms[1]);
+        runner.value(name.c_str(), "pressure_rms", result.pthRms[2]);
+        runner.value(name.c_str(), "pm25_rms", result.pm25Rms);
+        runner.value(name.c_str(), "pm25_max_error", result.pm25Max);
+        runner.value(name.c_str(), "delivery_ratio", result.exchanges > 0 ? double(result.delivered) / result.exchanges : 0);
+        runner.value(name.c_str(), "radio_attempts_per_day", result.attempts / days);
+        runner.value(name.c_str(), "wakes_per_day", result.wakes / days);
+        runner.value(name.c_str(), "pth_measurements_per_day", result.pthMeasurements / days);
+        runner.value(name.c_str(), "sps30_seconds_per_day", result.sps30Seconds / days);
+        runner.value(name.c_str(), "charge_mah_per_day", result.chargeMilliampSeconds / 3600 / days);
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "WakePathBenchmarks.h"
+#include "BatchCodecBenchmarks.h"
+
+#include "AppConfig.h"
+#include "MeasurementMessage.h"
+#include "PTHProvider.h"
+#include "SessionKeys.h"
+#include "WakeProfiler.h"
+
+#include "PersistentStorage.h"
+#include "Delays.h"
+#include "esp32-esp-idf/I2CBus.h"
+
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <nvs_flash.h>
+#include <sdkconfig.h>
+#include <cstring>
+
+namespace
+{
+struct TargetClock
+{
+    static constexpr bool hasCycles = true;
+    static int64_t nanoseconds() { return esp_timer_get_time() * 1000; }
+    static uint32_t cycles() { return cpuCycleCount(); }
+};
+
+// Same size as the controller's persistent record
+struct Record
+{
+    uint8_t status = 0;
+    int16_t pm[3] = {};
+    uint16_t voltageRaw = 0;
+    char serial[32] = {};
+    time_t lastPMMeasureStarted = 0;
+    time_t firstSyncTime = 0;
+    bool insufficientPower = false;
+};
+
+// ESP-NOW vendor action frame around the payload: MAC header, category, OUI, random value, element header, FCS
+constexpr size_t espNowFrameOverhead = 24 + 1 + 3 + 4 + 7 + 4;
+// CCMP header and MIC
+constexpr size_t ccmpOverhead = 16;
+// Long preamble and PLCP header of the 1 Mbps rate the link falls back to
+constexpr double preambleMicroseconds = 192;
+
+std::array<uint8_t, 2048> storageArray;
+// Four hours of minute samples
+std::array<BatchCodec::Sample, 240> batchSamples;
+}
+
+extern "C" [[noreturn]] void app_main()
+{
+    benchmark::Runner<TargetClock> runner(CONFIG_IDF_TARGET);
+    benchmark::runWakePathBenchmarks(runner);
+    benchmark::makeSyntheticSeries(batchSamples.data(), batchSamples.size());
+    benchmark::runBatchCodecBenchmarks(runner, batchSamples.data(), batchSamples.size());
+
+    embedded::PersistentStorage storage(storageArray, true);
+    constexpr std::string_view tag = "BNCH";
+    Record record;
+    runner.run("persistent_storage_set", 10000, [&]() {
+        ++record.voltageRaw;
+        storage.set(tag, record);
+    });
+    runner.run("persistent_storage_get", 10000, [&]() {
+        auto restored = storage.get<Record>(tag);
+        benchmark::doNotOptimize(restored);
+    });
+
+    embedded::I2CBus i2CBus(0);
+    i2CBus.init(AppConfig::SDA, AppConfig::SCL, 100000);
+    embedded::I2CHelper i2CDevice(i2CBus, AppConfig::bme280Address);
+    PTHProvider pthProvider(storage, i2CDevice);
+    if (pthProvider.setup(false))
+    {
+        runner.run("pth_measurement", 50, [&]() {
+            pthProvider.activate();
+            pthProvider.doMeasure(1000);
+            auto temperature = pthProvider.getTemperature();
+            benchmark::doNotOptimize(temperature);
+        });
+    }
+    else
+    {
+        printf("BME280 is not found, sensor benchmarks are skipped\n");
+    }
+
+    // The session key is derived once per epoch, every wake only registers the encrypted peer entry
+    runner.run("session_key_derivation", 100, [&]() {
+        auto key = SessionKeys::derive("LMK", 1, AppConfig::macAddress.data());
+        benchmark::doNotOptimize(key);
+    });
+    nvs_flash_init();
+    esp_netif_init();
+    esp_event_loop_create_default();
+    wifi_init_config_t wifiConfig = WIFI_INIT_CONFIG_DEFAULT();
+    esp_wifi_init(&wifiConfig);
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    esp_wifi_start();
+    esp_now_init();
+    const auto primaryKey = SessionKeys::derive("PMK", 0, nullptr);
+    esp_now_set_pmk(primaryKey.data());
+    const auto localKey = SessionKeys::derive("LMK", 1, AppConfig::macAddress.data());
+    for (const bool encrypted : { false, true })
+    {
+        esp_now_peer_info_t peerInfo {};
+        memcpy(peerInfo.peer_addr, AppConfig::macAddress.data(), sizeof(peerInfo.peer_addr));
+        peerInfo.ifidx = WIFI_IF_STA;
+        peerInfo.encrypt = encrypted;
+        memcpy(peerInfo.lmk, localKey.data(), sizeof(peerInfo.lmk));
+        runner.run(encrypted ? "espnow_add_peer_encrypted" : "espnow_add_peer_plain", 200, [&]() {
+            esp_now_add_peer(&peerInfo);
+            esp_now_del_peer(peerInfo.peer_addr);
+        });
+    }
+    esp_now_deinit();
+    esp_wifi_stop();
+    const auto measurementBytes = sizeof(MeasurementMessage) + espNowFrameOverhead;
+    runner.value("espnow_ccmp", "frame_overhead_bytes", ccmpOverhead);
+    runner.value("espnow_ccmp", "measurement_airtime_us_1m", preambleMicroseconds + measurementBytes * 8);
+    runner.value("espnow_ccmp", "ccmp_airtime_us_1m", ccmpOverhead * 8);
+
+    printf("BENCH {\"kind\":\"done\"}\n");
+    fflush(stdout);
+    while (true)
+    {
+        embedded::delay(1000);
+    }
+}
@@ -20,4 +20,22 @@ struct AppConfig
     static const uint8_t voltagePin;
     static const float batteryVoltageDivider;
     static const bool restrictTxPower;
+    // Allow 802.11 LR rates when the link is poor; the indoor unit must have LR enabled too
+    static const bool allowLongRange;
+    // Input reading high while the USB power is connected (VBUS through a divider), -1 when not wired
+    static const int8_t usbSensePin;
+    // Without the sense pin: divider reading in volts above which the unit is considered to be on the USB power;
+    // requires the divider on the charger input, the battery side never exceeds the charge voltage
+    static const float externalPowerVoltage;
+    // Forward the records of the other units while on the USB power
+    static const bool relayRole;
+    // Relays the unit may route through when the indoor unit is hard to reach, all zeros for an unused entry
+    static const std::array<std::array<uint8_t, 6>, 2> relayAddresses;
+    // Units the relay role answers and forwards, all zeros for an unused entry
+    static const std::array<std::array<uint8_t, 6>, 4> relayedUnits;
+    // Encrypt the link to the indoor unit with the keys derived from the pre-shared key
+    static const bool encryptEspNow;
+    static const std::array<uint8_t, 32> preSharedKey;
+    // Send the PTH and battery values as the FixedPoint.h counts instead of floats; the indoor unit must decode them
+    static const bool fixedPointMessage;
 };
\ No newline at end of file
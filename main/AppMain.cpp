@@ -1,6 +1,7 @@
 #include "DustMonitorController.h"
 
 #include "AppConfig.h"
+#include "PersistentLayout.h"
 
 #include "Delays.h"
 #include "PacketUart.h"
@@ -13,6 +14,9 @@
 #include <esp_system.h>
 #include <nvs_flash.h>
 
+#include "BinaryLog.h"
+#include "SensorTrace.h"
+#include "WakeProfiler.h"
 #include "Debug.h"
 
 using ResetReason = DustMonitorController::ResetReason;
@@ -39,7 +43,7 @@ private:
     DustMonitorController controller;
 };
 
-RTC_DATA_ATTR std::array<uint8_t, 2048> persistentArray;
+RTC_DATA_ATTR std::array<uint8_t, PersistentLayout::storageSize> persistentArray;
 std::optional<embedded::PersistentStorage> persistentStorage;
 std::optional<ControllerHolder> controllerHolder;
 
@@ -67,8 +71,12 @@ bool setup(ResetReason resetReason)
 #ifdef DEBUG_SERIAL_OUT
     embedded::PacketUart::UartDevice::init(0, AppConfig::serial1RxPin, AppConfig::serial1TxPin, 115200);
 #endif
-    DEBUG_LOG((resetReason == ResetReason::DeepSleep ? "Wake up after sleep" : (resetReason == ResetReason::BrownOut ? "Reset after voltage drop" : "Initial startup")))
+    WAKE_LOG("Startup, reset reason %d (0 - power on, 1 - deep sleep, 2 - voltage drop)", static_cast<int>(resetReason))
     persistentStorage.emplace(persistentArray, resetReason != ResetReason::DeepSleep);
+    if (resetReason != ResetReason::DeepSleep)
+    {
+        PersistentLayout::clearStored();
+    }
     embedded::PacketUart::UartDevice::init(AppConfig::Sps30UartNum, AppConfig::sps30RxPin, AppConfig::sps30TxPin, 115200);
     controllerHolder.emplace(*persistentStorage, AppConfig::Sps30UartNum, AppConfig::bme280Address, AppConfig::restrictTxPower);
     return controllerHolder->getController().setup(resetReason);
@@ -88,12 +96,43 @@ extern "C" [[noreturn]] void app_main()
     if (!setup(resetReason))
     {
         DEBUG_LOG("Setup failed. No sensors found of failed to initialize WiFi. Terminating...")
+#ifdef DEBUG_BINARY_LOG
+        BinaryLog::drain();
+#endif
+#ifdef SENSOR_TRACE
+        SensorTrace::drain();
+#endif
         embedded::delay(1000);
         std::terminate();
     }
 
-    const auto delayTime = controllerHolder->getController().process();
+    auto delayTime = controllerHolder->getController().process();
+    if (controllerHolder->getController().isStreaming())
+    {
+        // Returns only when the external power is gone
+        delayTime = controllerHolder->getController().stream();
+    }
     controllerHolder->getController().hibernate();
-    DEBUG_LOG("Going to deep sleep for " << delayTime << " ms")
+    if (controllerHolder->getController().isRestartRequired())
+    {
+        DEBUG_LOG("Restarting into the updated firmware")
+#ifdef DEBUG_BINARY_LOG
+        BinaryLog::drain();
+#endif
+#ifdef SENSOR_TRACE
+        SensorTrace::drain();
+#endif
+        esp_restart();
+    }
+    WAKE_LOG("Going to deep sleep for %u ms", static_cast<unsigned>(delayTime))
+#ifdef WAKE_PROFILING
+    WakeProfiler::report();
+#endif
+#ifdef DEBUG_BINARY_LOG
+    BinaryLog::drainIfNeeded();
+#endif
+#ifdef SENSOR_TRACE
+    SensorTrace::drainIfNeeded();
+#endif
     embedded::deepSleep(delayTime);
 }
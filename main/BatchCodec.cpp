@@ -0,0 +1,330 @@
+#include "BatchCodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+constexpr size_t headerSize = 6;
+// Every channel takes at least one byte per sample
+constexpr size_t minSampleSize = 9;
+constexpr uint8_t xorSameValue = 0;
+constexpr uint8_t xorPresentBit = 0x80;
+
+class Writer
+{
+public:
+    Writer(uint8_t* buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    void byte(uint8_t value)
+    {
+        if (position < capacity)
+        {
+            buffer[position] = value;
+        }
+        ++position;
+    }
+
+    void varint(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            byte(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        byte(static_cast<uint8_t>(value));
+    }
+
+    void signedVarint(int64_t value)
+    {
+        varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    bool fits() const { return position <= capacity; }
+    size_t size() const { return position; }
+
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t position = 0;
+};
+
+class Reader
+{
+public:
+    Reader(const uint8_t* data, size_t size) : data(data), dataSize(size) {}
+
+    uint8_t byte()
+    {
+        if (position >= dataSize)
+        {
+            failed = true;
+            return 0;
+        }
+        return data[position++];
+    }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            const auto next = byte();
+            value |= uint64_t(next & 0x7f) << shift;
+            if (!(next & 0x80))
+            {
+                return value;
+            }
+        }
+        failed = true;
+        return 0;
+    }
+
+    int64_t signedVarint()
+    {
+        const auto value = varint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    bool isFailed() const { return failed; }
+    bool atEnd() const { return position == dataSize; }
+
+private:
+    const uint8_t* data;
+    size_t dataSize;
+    size_t position = 0;
+    bool failed = false;
+};
+
+template<int32_t Scale>
+float toFloat(int32_t value)
+{
+    return static_cast<float>(value) / Scale;
+}
+
+template<int32_t Scale>
+int32_t fromFloat(float value)
+{
+    return static_cast<int32_t>(std::lround(static_cast<double>(value) * Scale));
+}
+
+uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bitsToFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+template<typename Get>
+void writeDeltas(Writer& writer, const BatchCodec::Sample* samples, size_t count, Get get)
+{
+    int64_t previous = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int64_t value = get(samples[i]);
+        writer.signedVarint(value - previous);
+        previous = value;
+    }
+}
+
+template<typename Set>
+void readDeltas(Reader& reader, BatchCodec::Sample* samples, size_t count, Set set)
+{
+    int64_t value = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        value += reader.signedVarint();
+        set(samples[i], value);
+    }
+}
+
+// Control byte: 0 for a repeated value, otherwise 0x80 | leading zero bytes << 2 | trailing zero bytes,
+// followed by the remaining bytes of the XOR with the previous value
+template<typename Get>
+void writeXor(Writer& writer, const BatchCodec::Sample* samples, size_t count, Get get)
+{
+    uint32_t previous = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto bits = floatBits(get(samples[i]));
+        auto difference = bits ^ previous;
+        previous = bits;
+        if (difference == 0)
+        {
+            writer.byte(xorSameValue);
+            continue;
+        }
+        uint8_t leading = 0;
+        while (!(difference & (0xffu << (24 - 8 * leading))))
+        {
+            ++leading;
+        }
+        uint8_t trailing = 0;
+        while (!(difference & 0xffu))
+        {
+            difference >>= 8;
+            ++trailing;
+        }
+        writer.byte(xorPresentBit | (leading << 2) | trailing);
+        for (int byte = 0; byte < 4 - leading - trailing; ++byte)
+        {
+            writer.byte(static_cast<uint8_t>(difference >> (8 * byte)));
+        }
+    }
+}
+
+template<typename Set>
+void readXor(Reader& reader, BatchCodec::Sample* samples, size_t count, Set set)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto control = reader.byte();
+        if (control != xorSameValue)
+        {
+            const int leading = (control >> 2) & 0x03;
+            const int trailing = control & 0x03;
+            uint32_t difference = 0;
+            for (int byte = 0; byte < 4 - leading - trailing; ++byte)
+            {
+                difference |= uint32_t(reader.byte()) << (8 * byte);
+            }
+            value ^= difference << (8 * trailing);
+        }
+        set(samples[i], bitsToFloat(value));
+    }
+}
+
+void encodeFrame(Writer& writer, const BatchCodec::Sample* samples, size_t count, BatchCodec::Options options)
+{
+    using BatchCodec::Sample;
+    for (size_t i = 0; i < sizeof(BatchCodec::batchMagic); ++i)
+    {
+        writer.byte(static_cast<uint8_t>(BatchCodec::batchMagic >> (8 * i)));
+    }
+    writer.byte(static_cast<uint8_t>(options));
+    writer.byte(static_cast<uint8_t>(count));
+    writer.signedVarint(samples[0].timestampMilliseconds);
+    int64_t previousDelta = 0;
+    for (size_t i = 1; i < count; ++i)
+    {
+        const auto delta = samples[i].timestampMilliseconds - samples[i - 1].timestampMilliseconds;
+        writer.signedVarint(delta - previousDelta);
+        previousDelta = delta;
+    }
+    if (options == BatchCodec::Options::XorFloat)
+    {
+        writeXor(writer, samples, count, [](const Sample& sample) { return toFloat<FixedPoint::humidityScale>(sample.data.humidity); });
+        writeXor(writer, samples, count, [](const Sample& sample) { return toFloat<FixedPoint::temperatureScale>(sample.data.temperature); });
+        writeXor(writer, samples, count, [](const Sample& sample) { return toFloat<FixedPoint::pressureScale>(sample.data.pressure); });
+    }
+    else
+    {
+        writeDeltas(writer, samples, count, [](const Sample& sample) { return sample.data.humidity; });
+        writeDeltas(writer, samples, count, [](const Sample& sample) { return sample.data.temperature; });
+        writeDeltas(writer, samples, count, [](const Sample& sample) { return sample.data.pressure; });
+    }
+    writeDeltas(writer, samples, count, [](const Sample& sample) { return sample.data.pm01; });
+    writeDeltas(writer, samples, count, [](const Sample& sample) { return sample.data.pm25; });
+    writeDeltas(writer, samples, count, [](const Sample& sample) { return sample.data.pm10; });
+    writeDeltas(writer, samples, count, [](const Sample& sample) { return sample.data.batteryVoltage; });
+    for (size_t i = 0; i < count; ++i)
+    {
+        writer.varint(samples[i].data.flags);
+    }
+}
+
+} // namespace
+
+size_t BatchCodec::encode(const Sample* samples, size_t count, Options options, uint8_t* buffer, size_t capacity, size_t& size)
+{
+    size = 0;
+    count = std::min(count, maxSamples);
+    if (count == 0 || capacity < headerSize)
+    {
+        return 0;
+    }
+    // The columns can't be appended sample by sample, so look for the longest prefix that fits
+    size_t fitting = 0;
+    size_t lastEncoded = 0;
+    size_t lower = 1;
+    size_t upper = std::min(count, (capacity - headerSize) / minSampleSize);
+    while (lower <= upper)
+    {
+        const auto middle = lower + (upper - lower) / 2;
+        Writer writer(buffer, capacity);
+        encodeFrame(writer, samples, middle, options);
+        lastEncoded = middle;
+        if (writer.fits())
+        {
+            fitting = middle;
+            size = writer.size();
+            lower = middle + 1;
+        }
+        else
+        {
+            upper = middle - 1;
+        }
+    }
+    if (fitting > 0 && fitting != lastEncoded)
+    {
+        Writer writer(buffer, capacity);
+        encodeFrame(writer, samples, fitting, options);
+    }
+    return fitting;
+}
+
+size_t BatchCodec::decode(const uint8_t* frame, size_t size, Sample* samples, size_t capacity)
+{
+    Reader reader(frame, size);
+    uint32_t magic = 0;
+    for (size_t i = 0; i < sizeof(magic); ++i)
+    {
+        magic |= uint32_t(reader.byte()) << (8 * i);
+    }
+    const auto options = static_cast<Options>(reader.byte());
+    const size_t count = reader.byte();
+    if (reader.isFailed() || magic != batchMagic || count == 0 || count > capacity
+        || (options != Options::FixedPoint && options != Options::XorFloat))
+    {
+        return 0;
+    }
+    samples[0] = Sample {};
+    samples[0].timestampMilliseconds = reader.signedVarint();
+    int64_t delta = 0;
+    for (size_t i = 1; i < count; ++i)
+    {
+        samples[i] = Sample {};
+        delta += reader.signedVarint();
+        samples[i].timestampMilliseconds = samples[i - 1].timestampMilliseconds + delta;
+    }
+    if (options == Options::XorFloat)
+    {
+        readXor(reader, samples, count, [](Sample& sample, float value) { sample.data.humidity = fromFloat<FixedPoint::humidityScale>(value); });
+        readXor(reader, samples, count, [](Sample& sample, float value) { sample.data.temperature = fromFloat<FixedPoint::temperatureScale>(value); });
+        readXor(reader, samples, count, [](Sample& sample, float value) { sample.data.pressure = fromFloat<FixedPoint::pressureScale>(value); });
+    }
+    else
+    {
+        readDeltas(reader, samples, count, [](Sample& sample, int64_t value) { sample.data.humidity = static_cast<int32_t>(value); });
+        readDeltas(reader, samples, count, [](Sample& sample, int64_t value) { sample.data.temperature = static_cast<int32_t>(value); });
+        readDeltas(reader, samples, count, [](Sample& sample, int64_t value) { sample.data.pressure = static_cast<int32_t>(value); });
+    }
+    readDeltas(reader, samples, count, [](Sample& sample, int64_t value) { sample.data.pm01 = static_cast<int16_t>(value); });
+    readDeltas(reader, samples, count, [](Sample& sample, int64_t value) { sample.data.pm25 = static_cast<int16_t>(value); });
+    readDeltas(reader, samples, count, [](Sample& sample, int64_t value) { sample.data.pm10 = static_cast<int16_t>(value); });
+    readDeltas(reader, samples, count, [](Sample& sample, int64_t value) { sample.data.batteryVoltage = static_cast<int32_t>(value); });
+    for (size_t i = 0; i < count; ++i)
+    {
+        samples[i].data.flags = static_cast<uint32_t>(reader.varint());
+    }
+    return reader.isFailed() || !reader.atEnd() ? 0 : count;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "MeasurementMessage.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Columnar encoding of a batch of measurements into one ESP-NOW frame.
+// Layout, little endian:
+//  magic (4 bytes), options (1 byte), sample count (1 byte), first timestamp in milliseconds (zigzag varint),
+//  then one column per channel, each holding the values of all the samples:
+//   timestamps  - first delta, then delta-of-delta
+//   humidity, temperature, pressure - fixed-point value of the first sample and deltas, or XOR-compressed floats
+//   pm01, pm25, pm10, battery voltage (mV) - first value and deltas
+// The fixed-point values are the counts of FixedPoint.h.
+//   flags - raw values
+// All the integers are zigzag LEB128 varints. Decoded by tools/batch_codec.py on the host.
+namespace BatchCodec
+{
+
+constexpr uint32_t batchMagic = 0x48435442; // "BTCH"
+constexpr size_t maxFrameSize = 250;
+constexpr size_t maxSamples = 255;
+
+enum class Options : uint8_t
+{
+    FixedPoint = 0,
+    // The PTH values are converted to floats and stored as XOR with the previous value with the zero bytes dropped
+    XorFloat = 1,
+};
+
+struct Sample
+{
+    int64_t timestampMilliseconds;
+    MeasurementData data;
+};
+
+// Encodes the longest prefix of the samples that fits into the buffer.
+// Returns the number of samples encoded, size receives the frame size.
+size_t encode(const Sample* samples, size_t count, Options options, uint8_t* buffer, size_t capacity, size_t& size);
+// Returns the number of samples decoded, 0 for a malformed frame.
+size_t decode(const uint8_t* frame, size_t size, Sample* samples, size_t capacity);
+
+}
@@ -0,0 +1,86 @@
+#include "BinaryLog.h"
+
+#include <esp_attr.h>
+#include <freertos/FreeRTOS.h>
+
+namespace
+{
+// Record layout: total size (1 byte), format hash (4 bytes), packed arguments.
+// The record with the zero hash carries the number of records dropped because the buffer was full.
+constexpr size_t bufferSize = 1024;
+constexpr size_t drainThreshold = bufferSize / 2;
+constexpr size_t headerSize = 5;
+constexpr uint32_t droppedRecordsId = 0;
+
+RTC_DATA_ATTR std::array<uint8_t, bufferSize> logBuffer;
+RTC_DATA_ATTR uint16_t logHead = 0;
+RTC_DATA_ATTR uint16_t logUsed = 0;
+RTC_DATA_ATTR uint16_t droppedRecords = 0;
+portMUX_TYPE logLock = portMUX_INITIALIZER_UNLOCKED;
+
+void put(const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        logBuffer[(logHead + logUsed) % bufferSize] = data[i];
+        ++logUsed;
+    }
+}
+
+bool append(uint32_t id, const uint8_t* arguments, size_t size)
+{
+    const auto recordSize = headerSize + size;
+    if (recordSize > 255 || logUsed + recordSize > bufferSize)
+    {
+        return false;
+    }
+    const auto recordSizeByte = static_cast<uint8_t>(recordSize);
+    put(&recordSizeByte, 1);
+    put(reinterpret_cast<const uint8_t*>(&id), sizeof(id));
+    put(arguments, size);
+    return true;
+}
+
+} // namespace
+
+void BinaryLog::write(uint32_t id, const uint8_t* arguments, size_t size)
+{
+    portENTER_CRITICAL(&logLock);
+    if (droppedRecords > 0)
+    {
+        const uint32_t dropped = droppedRecords;
+        if (append(droppedRecordsId, reinterpret_cast<const uint8_t*>(&dropped), sizeof(dropped)))
+        {
+            droppedRecords = 0;
+        }
+    }
+    if (droppedRecords > 0 || !append(id, arguments, size))
+    {
+        ++droppedRecords;
+    }
+    portEXIT_CRITICAL(&logLock);
+}
+
+void BinaryLog::drainIfNeeded()
+{
+    if (logUsed >= drainThreshold || droppedRecords > 0)
+    {
+        drain();
+    }
+}
+
+void BinaryLog::drain()
+{
+    if (logUsed == 0)
+    {
+        return;
+    }
+    printf("BLOG ");
+    for (; logUsed > 0; --logUsed)
+    {
+        printf("%02x", logBuffer[logHead]);
+        logHead = (logHead + 1) % bufferSize;
+    }
+    printf("\n");
+    fflush(stdout);
+}
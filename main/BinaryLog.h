@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+// Deferred logging for the wake path.
+// WAKE_LOG takes a printf-style format literal. With DEBUG_BINARY_LOG the call site only stores the format hash
+// and the raw arguments into a ring buffer in RTC memory; the buffer is printed as hex from time to time and
+// decoded on the host by tools/binary_log.py. Integers are stored as 32 or 64 bits, floating point values as float.
+// Supported conversions: %d %i %u %x %X with optional ll, and %f.
+namespace BinaryLog
+{
+
+constexpr uint32_t formatId(std::string_view format)
+{
+    uint32_t hash = 2166136261u;
+    for (const auto symbol : format)
+    {
+        hash ^= static_cast<uint8_t>(symbol);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template<typename T>
+constexpr size_t packedSize()
+{
+    return (std::is_floating_point_v<T> || sizeof(T) <= 4) ? 4 : 8;
+}
+
+template<typename T>
+uint8_t* pack(uint8_t* out, T value)
+{
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        const auto packed = static_cast<float>(value);
+        memcpy(out, &packed, sizeof(packed));
+    }
+    else if constexpr (sizeof(T) <= 4)
+    {
+        using Packed = std::conditional_t<std::is_signed_v<T>, int32_t, uint32_t>;
+        const auto packed = static_cast<Packed>(value);
+        memcpy(out, &packed, sizeof(packed));
+    }
+    else
+    {
+        memcpy(out, &value, sizeof(value));
+    }
+    return out + packedSize<T>();
+}
+
+void write(uint32_t id, const uint8_t* arguments, size_t size);
+
+template<typename... Args>
+void log(uint32_t id, Args... args)
+{
+    std::array<uint8_t, (packedSize<Args>() + ... + 0)> arguments {};
+    [[maybe_unused]] uint8_t* out = arguments.data();
+    ((out = pack(out, args)), ...);
+    write(id, arguments.data(), arguments.size());
+}
+
+// Prints the buffered records when the buffer is filled above the threshold.
+void drainIfNeeded();
+// Prints all the buffered records.
+void drain();
+
+}
+
+#if defined(DEBUG_BINARY_LOG)
+#define WAKE_LOG(format, ...) { constexpr uint32_t wakeLogId = BinaryLog::formatId(format); BinaryLog::log(wakeLogId, ##__VA_ARGS__); }
+#elif defined(DEBUG_SERIAL_OUT)
+#define WAKE_LOG(format, ...) { printf(format "\n", ##__VA_ARGS__); }
+#else
+#define WAKE_LOG(format, ...)
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+// Wire format of the diagnostics report, sent to the indoor unit from time to time after a completed
+// measurement exchange. The indoor unit does not answer it.
+// The size never equals sizeof(CorrectionMessage) or sizeof(MeasurementMessage).
+constexpr uint32_t diagnosticsMagic = 0x47414944; // "DIAG"
+
+struct __attribute__((packed)) DiagnosticsMessage
+{
+    uint32_t magic;
+    // Worst cases since the last power on
+    uint32_t minFreeHeap;
+    // Unused stack in bytes
+    uint16_t mainStackFree;
+    uint16_t timerStackFree;
+    uint16_t wifiStackFree;
+    uint16_t sps30StackFree;
+    // RTC bytes taken by the stored records with their overhead out of the storage size
+    uint16_t persistentUsed;
+    uint16_t persistentCapacity;
+    // Size of each record stored since the power on, per PersistentLayout::budgets
+    uint8_t persistentRecords[11];
+    // Per WakeDeadline::Phase
+    uint16_t phaseOverruns[5];
+    // Wakes cut by the hard time limit
+    uint16_t abortedWakes;
+};
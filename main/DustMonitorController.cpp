@@ -3,40 +3,59 @@
 
 #include "TimeFunctions.h"
 #include "AppConfig.h"
+#include "FixedPoint.h"
+#include "PersistentLayout.h"
+#include "PowerProfile.h"
+#include "SensorTrace.h"
+#include "WakeProfiler.h"
+#include "WakeSchedule.h"
 
 #include <PacketUart.h>
 #include <PersistentStorage.h>
 #include "AnalogPin.h"
 
+#include "Delays.h"
 #include "esp32-esp-idf/GpioPinDefinition.h"
+#include <driver/gpio.h>
+#include <cmath>
 
+#include "BinaryLog.h"
 #include <Debug.h>
 
 namespace
 {
-constexpr int sps30MeasurementDuration = 30; //seconds
 constexpr int insufficientPowerThreshold = 50 * 60; //seconds
 
 constexpr float rawToVolts = 3.3f/4095;
+constexpr int minimumShutdownMilliseconds = 100;
+// OTA chunk window and the diagnostics report are skipped when less time is left in the wake
+constexpr int minimumOtaMilliseconds = 300;
 constexpr std::string_view controllerDataTag = "DMC";
+constexpr std::string_view schedulerDataTag = "WSCH";
 
-bool isTimeSyncronized(time_t time)
-{
-    return time > 1692025000;
-}
+// Streaming on the external power: PTH and PM sampled every 10 s, sent as batch frames every minute and the
+// regular measurement exchange for the time synchronization every 10 minutes
+constexpr int64_t streamingSampleMicroseconds = 10 * microsecondsInSecond;
+constexpr int64_t streamingFlushMicroseconds = microsecondsInMinute;
+constexpr int64_t streamingSyncMicroseconds = 10 * microsecondsInMinute;
+constexpr int streamingPthMilliseconds = 150;
+constexpr int streamingReadoutMilliseconds = 400;
+constexpr int streamingRadioMilliseconds = 1000;
+constexpr int streamingShutdownMilliseconds = 1000;
+// Consecutive readings needed to change the power source, and the hysteresis of the threshold in mV
+constexpr uint8_t powerSourceConfirmations = 3;
+constexpr int32_t externalPowerHysteresis = 100;
 
-tm getLocalTime(time_t time)
-{
-    tm info {};
-    localtime_r(&time, &info);
-    return info;
-}
+// Samples not delivered yet; the oldest are dropped when the indoor unit is out of reach for too long
+std::array<BatchCodec::Sample, 64> streamingSamples;
+size_t streamingSamplesCount = 0;
 
 int readVoltageRaw()
 {
     embedded::GpioPinDefinition voltagePin { AppConfig::voltagePin };
     const auto voltage = embedded::AnalogPin(voltagePin).singleRead();
-    DEBUG_LOG("VoltageRaw is " << voltage)
+    WAKE_LOG("VoltageRaw is %d", voltage)
+    TRACE_SENSOR(battery(voltage))
     return voltage;
 }
 
@@ -52,22 +71,27 @@ void correctTime(const int64_t correction)
                 .tv_usec = static_cast<decltype(timeval::tv_usec)>(nowMicroseconds - nowSeconds * microsecondsInSecond)
         };
         settimeofday(&correctedTimeval, nullptr);
-        DEBUG_LOG("Time is corrected by " << correction << " us")
+        WAKE_LOG("Time is corrected by %lld us", correction)
     }
     else
     {
-        DEBUG_LOG("Small correction factor " << correction << " us is skipped")
+        WAKE_LOG("Small correction factor %lld us is skipped", correction)
     }
 }
 
 enum class SensorFlags : uint32_t {
     BatteryFailure = 1 << 0,
+    // Humidity, temperature and pressure are not measured during this wake
+    PthInvalid = 1 << 1,
 };
 } // namespace
 
 bool DustMonitorController::setup(ResetReason resetReason)
 {
+    WAKE_PHASE(Setup)
     bool wakeUp = resetReason == ResetReason::DeepSleep;
+    deadline.setup(wakeUp);
+    PowerProfile::setup();
     if (!wakeUp)
     {
         HardwareSensorControl::initStepUpControl(false);
@@ -81,8 +105,19 @@ bool DustMonitorController::setup(ResetReason resetReason)
         {
             controllerData = *data;
         }
+        if (auto data = storage.get<WakeScheduler::State>(schedulerDataTag))
+        {
+            scheduler.restore(*data);
+        }
         HardwareSensorControl::initStepUpControl(SPS30Status::Measuring == controllerData.sps30Status);
     }
+    if (controllerData.millivoltsPerCount == 0)
+    {
+        // The only floating point work, the wakes convert the battery readings with the integer factors
+        controllerData.millivoltsPerCount = static_cast<uint32_t>(std::lround(
+                rawToVolts / AppConfig::batteryVoltageDivider * FixedPoint::voltageScale * (1 << FixedPoint::fractionBits)));
+        controllerData.externalPowerMillivolts = static_cast<int32_t>(std::lround(AppConfig::externalPowerVoltage * FixedPoint::voltageScale));
+    }
     sensorPresent = dustData.setup(wakeUp);
     if (!wakeUp)
     {
@@ -92,9 +127,12 @@ bool DustMonitorController::setup(ResetReason resetReason)
             const auto serial = dustData.getSpsSerial();
             memcpy(controllerData.sps30Serial, serial.begin(), serial.size());
             dustData.sleep();
-            HardwareSensorControl::switchStepUpConversion(false);
         }
+        // Also without the sensor, it is powered again for the re-probes only
+        HardwareSensorControl::switchStepUpConversion(false);
     }
+    ota.setup(wakeUp);
+    memoryMonitor.setup(wakeUp);
     auto meteoResul = meteoData.setup(wakeUp);
     auto viewResult = transport.setup(controllerData.sps30Serial, wakeUp);
     return (meteoResul | sensorPresent)  && viewResult ;
@@ -103,20 +141,32 @@ bool DustMonitorController::setup(ResetReason resetReason)
 uint32_t DustMonitorController::process()
 {
     const auto currentTime = time(nullptr);
-    const bool isTimeGood = isTimeSyncronized(currentTime);
+    const bool isTimeGood = WakeSchedule::isTimeSynchronized(currentTime);
     if (isTimeGood)
     {
         if (controllerData.firstSyncTime == 0)
         {
             controllerData.firstSyncTime = currentTime;
         }
+        if (!scheduler.isActive())
+        {
+            WakeSchedule::start(scheduler, currentTime);
+        }
+        // The SPS30 doesn't fit into the budget while the power is insufficient
+        dueJobs = scheduler.collectDue(currentTime, controllerData.insufficientPower ?
+                                                    WakeSchedule::lowPowerBudget : WakeSchedule::unlimitedBudget);
+        if (isJobDue(WakeSchedule::BatteryCheck))
+        {
+            controllerData.voltageRaw = readVoltageRaw();
+            scheduler.complete(WakeSchedule::BatteryCheck, currentTime);
+        }
+        if (!sensorPresent && !controllerData.insufficientPower && dustData.isProbeDue(currentTime))
+        {
+            probeSPS30(currentTime);
+        }
         if (sensorPresent)
         {
-            if (!controllerData.insufficientPower)
-            {
-                processSPS30Measurement();
-            }
-            else
+            if (controllerData.insufficientPower)
             {
                 HardwareSensorControl::switchStepUpConversion(false);
                 if (currentTime - controllerData.firstSyncTime > insufficientPowerThreshold)
@@ -124,95 +174,377 @@ uint32_t DustMonitorController::process()
                     controllerData.insufficientPower = false;
                 }
             }
+            processSPS30Measurement();
         }
-        needSend = getLocalTime(currentTime).tm_sec == 59;
-    }
-    else
-    {
-        needSend = true;
     }
+    // Every wake sends until the clock is set
+    needSend = !isTimeGood || isJobDue(WakeSchedule::Measurement);
 
     if (needSend)
     {
         needSend = false;
-        if (meteoData.activate() && meteoData.doMeasure())
+        scheduler.complete(WakeSchedule::Measurement, currentTime);
+        bool pthValid = false;
         {
+            WAKE_PHASE(Pth)
+            POWER_PROFILE(Wait)
+            const auto budget = deadline.start(WakeDeadline::Phase::Pth);
+            pthValid = budget > 0 && meteoData.activate() && meteoData.doMeasure(budget, WakeDeadline::isAborted);
+            pthValid = deadline.finish(WakeDeadline::Phase::Pth) && pthValid;
+            TRACE_SENSOR(pth(meteoData.getRawData().temperature, meteoData.getRawData().pressure
+                             , meteoData.getRawData().humidity, pthValid))
+            // Stops the measurement also after the timeout
             meteoData.hibernate();
         }
-        transport.sendData(
-                { meteoData.getHumidity(), meteoData.getTemperature(), meteoData.getPressure(), controllerData.pm01
-                  , controllerData.pm25, controllerData.pm10, float(controllerData.voltageRaw) * rawToVolts / AppConfig::batteryVoltageDivider
-                  , (controllerData.insufficientPower ? (uint32_t)SensorFlags::BatteryFailure : 0) });
+        collectSPS30Measurement();
+        WAKE_PHASE(Radio)
+        uint32_t flags = controllerData.insufficientPower ? (uint32_t)SensorFlags::BatteryFailure : 0;
+        if (!pthValid)
+        {
+            flags |= (uint32_t)SensorFlags::PthInvalid;
+        }
+        if (const auto budget = deadline.start(WakeDeadline::Phase::Radio); budget > 0 && transport.prepare())
+        {
+            // The slot and the reply are awaited without the light sleep, the radio keeps the APB lock itself
+            POWER_PROFILE(Io)
+            transport.sendData(
+                    { meteoData.getHumidity(), meteoData.getTemperature(), meteoData.getPressure(), controllerData.pm01
+                      , controllerData.pm25, controllerData.pm10
+                      , FixedPoint::millivoltsFromRaw(controllerData.voltageRaw, controllerData.millivoltsPerCount), flags }, budget);
+        }
+        deadline.finish(WakeDeadline::Phase::Radio);
     }
+    collectSPS30Measurement();
     if (transport.getStatus() == EspNowTransport::SendStatus::Completed)
     {
         correctTime(transport.getCorrection());
+        ota.onExchangeCompleted();
+        WAKE_PHASE(Radio)
+        if (deadline.start(WakeDeadline::Phase::Ota) >= minimumOtaMilliseconds)
+        {
+            ota.process(transport);
+            deadline.finish(WakeDeadline::Phase::Ota);
+            reportDiagnostics();
+        }
     }
 
-    auto nowMicroseconds = microsecondsNow();
-    const int64_t wholeMinutePast = (nowMicroseconds / microsecondsInMinute) * microsecondsInMinute;
-    const auto microsecondsTillNextMinute = wholeMinutePast + microsecondsInMinute - nowMicroseconds;
-    uint32_t delayTime = (microsecondsTillNextMinute <= HardwareSensorControl::bootEstimationMicroseconds) ?
-                        microsecondsInMinute + microsecondsTillNextMinute : microsecondsTillNextMinute;
-    delayTime -= HardwareSensorControl::bootEstimationMicroseconds;
-
-    if (controllerData.sps30Status == SPS30Status::Measuring)
+    if (isTimeGood)
     {
-        delayTime = std::min(delayTime, uint32_t(sps30MeasurementDuration * microsecondsInSecond));
+        updatePowerSource();
     }
+
+    const auto now = microsecondsNow();
+    // Every minute until the clock is set and the schedule starts
+    const auto wakeSecond = scheduler.nextWake(static_cast<uint32_t>(now / microsecondsInSecond));
+    const auto delayTime = wakeSecond == 0 ?
+            sleepMicrosecondsTillNextMinute(now, HardwareSensorControl::bootEstimationMicroseconds) :
+            sleepMicrosecondsTillSecondEnd(wakeSecond, now, HardwareSensorControl::bootEstimationMicroseconds);
     return static_cast<uint32_t>(delayTime/1000);
 }
 
+void DustMonitorController::probeSPS30(time_t now)
+{
+    WAKE_PHASE(Sps30)
+    HardwareSensorControl::switchStepUpConversion(true);
+    sensorPresent = dustData.probe(static_cast<uint32_t>(now));
+    if (sensorPresent)
+    {
+        // The transport sends the serial from the controller record
+        const auto serial = dustData.getSpsSerial();
+        memcpy(controllerData.sps30Serial, serial.begin(), std::min(serial.size(), sizeof(controllerData.sps30Serial)));
+        dustData.sleep();
+    }
+    HardwareSensorControl::switchStepUpConversion(false);
+}
+
 void DustMonitorController::processSPS30Measurement()
 {
-    if (controllerData.sps30Status == SPS30Status::Measuring)
+    WAKE_PHASE(Sps30)
+    measurePM(controllerData.pmSequence);
+}
+
+SequenceState DustMonitorController::measurePM(SequenceFrame& frame)
+{
+    SEQUENCE_BEGIN(frame)
+    SEQUENCE_WAIT_UNTIL(isJobDue(WakeSchedule::PmMeasurement))
+    WAKE_LOG("Starting PM measurement")
+    HardwareSensorControl::switchStepUpConversion(true);
+    PowerProfile::holdSps30Io(true);
+    dustData.startMeasure(isJobDue(WakeSchedule::FanCleaning));
+    controllerData.sps30Status = SPS30Status::Measuring;
+    HardwareSensorControl::holdStepUpConversion();
+    controllerData.voltageRaw = readVoltageRaw();
+    controllerData.lastPMMeasureStarted = time(nullptr);
+    scheduler.complete(WakeSchedule::PmMeasurement, controllerData.lastPMMeasureStarted);
+    if (isJobDue(WakeSchedule::FanCleaning))
+    {
+        scheduler.complete(WakeSchedule::FanCleaning, controllerData.lastPMMeasureStarted);
+    }
+    scheduler.scheduleOnce(WakeSchedule::PmReadout, WakeSchedule::pmReadout
+                           , controllerData.lastPMMeasureStarted + WakeSchedule::pmMeasurementSeconds);
+    // The readout job wakes the unit; a readout missed in its window runs right away, the sensor has to be stopped
+    SEQUENCE_WAIT_UNTIL(isJobDue(WakeSchedule::PmReadout) || !scheduler.isScheduled(WakeSchedule::PmReadout))
+    scheduler.complete(WakeSchedule::PmReadout, time(nullptr));
+    // The readout runs in background while the battery, BME280 and radio are handled
+    PowerProfile::holdSps30Io(true);
+    dustData.requestMeasureData();
+    sps30ReadoutPending = true;
+    controllerData.sps30Status = SPS30Status::Sleep;
+    controllerData.voltageRaw = readVoltageRaw();
+    SEQUENCE_END()
+}
+
+void DustMonitorController::collectSPS30Measurement()
+{
+    if (!sps30ReadoutPending)
+    {
+        return;
+    }
+    WAKE_PHASE(Sps30)
+    POWER_PROFILE(Wait)
+    sps30ReadoutPending = false;
+    sps30PowerOffPending = true;
+    const auto budget = deadline.start(WakeDeadline::Phase::Sps30Readout);
+    uint16_t p1, p25, p10;
+    const bool received = dustData.getMeasureData(p1, p25, p10, budget);
+    if (deadline.finish(WakeDeadline::Phase::Sps30Readout) && received)
+    {
+        controllerData.pm01 = static_cast<int16_t>(p1);
+        controllerData.pm25 = static_cast<int16_t>(p25);
+        controllerData.pm10 = static_cast<int16_t>(p10);
+    }
+    else
+    {
+        WAKE_LOG("Failed to obtain PMx data")
+        controllerData.pm01 = -1;
+        controllerData.pm10 = -1;
+        controllerData.pm25 = -1;
+    }
+    TRACE_SENSOR(pm(controllerData.pm01, controllerData.pm25, controllerData.pm10))
+}
+
+void DustMonitorController::finishSPS30Commands()
+{
+    WAKE_PHASE(Sps30)
+    POWER_PROFILE(Wait)
+    // Never skipped, the step-up has to be switched off
+    dustData.waitIdle(std::max(deadline.start(WakeDeadline::Phase::Sps30Shutdown), minimumShutdownMilliseconds));
+    deadline.finish(WakeDeadline::Phase::Sps30Shutdown);
+    PowerProfile::holdSps30Io(false);
+    if (sps30PowerOffPending)
+    {
+        sps30PowerOffPending = false;
+        HardwareSensorControl::switchStepUpConversion(false);
+        WAKE_LOG("PM Measurement finished")
+    }
+}
+
+void DustMonitorController::reportDiagnostics()
+{
+    const auto now = time(nullptr);
+    if (!memoryMonitor.isReportDue(now))
+    {
+        return;
+    }
+    memoryMonitor.sample();
+    auto report = memoryMonitor.makeReport();
+    deadline.fillReport(report);
+    if (transport.sendDiagnostics(report))
+    {
+        memoryMonitor.reportSent(now);
+    }
+}
+
+bool DustMonitorController::readExternalPower() const
+{
+    if (AppConfig::usbSensePin >= 0)
     {
-        if (const auto timestamp = time(nullptr); timestamp >=
-                                                  controllerData.lastPMMeasureStarted + sps30MeasurementDuration)
+        const auto sensePin = (gpio_num_t)AppConfig::usbSensePin;
+        gpio_set_direction(sensePin, GPIO_MODE_INPUT);
+        gpio_set_pull_mode(sensePin, GPIO_FLOATING);
+        return gpio_get_level(sensePin) != 0;
+    }
+    // The battery divider can't tell the USB power, its reading stays at the charge voltage
+    const auto millivolts = FixedPoint::millivoltsFromRaw(readVoltageRaw(), controllerData.millivoltsPerCount);
+    const auto threshold = controllerData.externalPower ?
+            controllerData.externalPowerMillivolts - externalPowerHysteresis : controllerData.externalPowerMillivolts;
+    return millivolts >= threshold;
+}
+
+void DustMonitorController::updatePowerSource()
+{
+    if (readExternalPower() == controllerData.externalPower)
+    {
+        controllerData.powerSourceReadings = 0;
+        return;
+    }
+    if (++controllerData.powerSourceReadings >= powerSourceConfirmations)
+    {
+        controllerData.powerSourceReadings = 0;
+        controllerData.externalPower = !controllerData.externalPower;
+        WAKE_LOG("Power source changed, external power: %d", controllerData.externalPower)
+    }
+}
+
+uint32_t DustMonitorController::stream()
+{
+    WAKE_LOG("Streaming on the external power")
+    // Not bound by the wake deadline and the energy is not a concern any more
+    deadline.disarm();
+    POWER_PROFILE(Io)
+    PowerProfile::holdSps30Io(true);
+    dustData.waitIdle(streamingShutdownMilliseconds);
+    sps30PowerOffPending = false;
+    if (sensorPresent)
+    {
+        // Released from the deep sleep hold, so it can be switched off when the streaming ends
+        HardwareSensorControl::initStepUpControl(true);
+        if (controllerData.sps30Status != SPS30Status::Measuring)
         {
-            if (uint16_t p1, p25, p10; dustData.getMeasureData(p1, p25, p10))
-            {
-                controllerData.pm01 = static_cast<int16_t>(p1);
-                controllerData.pm25 = static_cast<int16_t>(p25);
-                controllerData.pm10 = static_cast<int16_t>(p10);
-                dustData.stopMeasure();
-            }
-            else
+            HardwareSensorControl::switchStepUpConversion(true);
+            // The readout of this wake may have put the sensor to sleep
+            dustData.wakeUp();
+            dustData.startMeasure();
+            controllerData.sps30Status = SPS30Status::Measuring;
+        }
+    }
+    transport.prepare();
+    transport.enableRelay(AppConfig::relayRole);
+
+    // The regular exchange is just done by process()
+    auto lastSync = microsecondsNow();
+    auto lastFlush = lastSync;
+    while (controllerData.externalPower && !ota.isRestartRequired())
+    {
+        const auto now = microsecondsNow();
+        const auto sampleTime = now + streamingSampleMicroseconds - now % streamingSampleMicroseconds;
+        for (auto left = sampleTime - now; left > 0; left = sampleTime - microsecondsNow())
+        {
+            if (transport.waitRelayed(static_cast<int>(left / 1000)))
             {
-                DEBUG_LOG("Failed to obtain PMx data")
-                controllerData.pm01 = -1;
-                controllerData.pm10 = -1;
-                controllerData.pm25 = -1;
+                transport.forwardRelayed();
             }
-            dustData.sleep();
-            controllerData.sps30Status = SPS30Status::Sleep;
-            controllerData.voltageRaw = readVoltageRaw();
-            HardwareSensorControl::switchStepUpConversion(false);
-            DEBUG_LOG("PM Measurement finished")
         }
+        const auto sample = takeStreamingSample();
+        queueStreamingSample(sample);
+        if (sample.timestampMilliseconds * 1000 - lastFlush >= streamingFlushMicroseconds)
+        {
+            lastFlush = sample.timestampMilliseconds * 1000;
+            flushStreamingSamples();
+            // Retries the records a failed forwarding has kept
+            transport.forwardRelayed();
+        }
+        if (sample.timestampMilliseconds * 1000 - lastSync >= streamingSyncMicroseconds
+            && transport.sendData(sample.data, streamingRadioMilliseconds))
+        {
+            lastSync = microsecondsNow();
+            correctTime(transport.getCorrection());
+            ota.onExchangeCompleted();
+            reportDiagnostics();
+        }
+        updatePowerSource();
+#ifdef SENSOR_TRACE
+        SensorTrace::drainIfNeeded();
+#endif
+    }
+
+    WAKE_LOG("Back to the battery schedule")
+    transport.enableRelay(false);
+    transport.forwardRelayed();
+    flushStreamingSamples();
+    if (sensorPresent)
+    {
+        // The last readout is already taken by the streaming, this one only precedes the stop and sleep commands
+        dustData.requestMeasureData();
+        dustData.waitIdle(streamingShutdownMilliseconds);
+        HardwareSensorControl::switchStepUpConversion(false);
+        controllerData.sps30Status = SPS30Status::Sleep;
+        // The hourly measurements continue from the next one on
+        controllerData.lastPMMeasureStarted = time(nullptr);
+        controllerData.pmSequence = SequenceFrame {};
+        scheduler.complete(WakeSchedule::PmMeasurement, controllerData.lastPMMeasureStarted);
+        scheduler.cancel(WakeSchedule::PmReadout);
+    }
+    PowerProfile::holdSps30Io(false);
+    return static_cast<uint32_t>(sleepMicrosecondsTillNextMinute(microsecondsNow(), HardwareSensorControl::bootEstimationMicroseconds) / 1000);
+}
+
+BatchCodec::Sample DustMonitorController::takeStreamingSample()
+{
+    uint32_t flags = 0;
+    if (!meteoData.activate() || !meteoData.doMeasure(streamingPthMilliseconds))
+    {
+        flags |= (uint32_t)SensorFlags::PthInvalid;
+    }
+    meteoData.hibernate();
+    TRACE_SENSOR(pth(meteoData.getRawData().temperature, meteoData.getRawData().pressure, meteoData.getRawData().humidity
+                     , (flags & (uint32_t)SensorFlags::PthInvalid) == 0))
+    uint16_t p1, p25, p10;
+    if (dustData.requestReadout() && dustData.getMeasureData(p1, p25, p10, streamingReadoutMilliseconds))
+    {
+        controllerData.pm01 = static_cast<int16_t>(p1);
+        controllerData.pm25 = static_cast<int16_t>(p25);
+        controllerData.pm10 = static_cast<int16_t>(p10);
     }
     else
     {
-        const auto currentTime = time(nullptr);
-        const bool shallStartMeasurement = (controllerData.lastPMMeasureStarted == 0) ||
-                (currentTime - controllerData.lastPMMeasureStarted > 10*60
-                    && getLocalTime(currentTime).tm_min == 59);
-        if (shallStartMeasurement)
+        WAKE_LOG("Failed to obtain PMx data")
+        controllerData.pm01 = -1;
+        controllerData.pm25 = -1;
+        controllerData.pm10 = -1;
+    }
+    TRACE_SENSOR(pm(controllerData.pm01, controllerData.pm25, controllerData.pm10))
+    controllerData.voltageRaw = readVoltageRaw();
+    return {
+            microsecondsNow() / 1000,
+            { meteoData.getHumidity(), meteoData.getTemperature(), meteoData.getPressure(), controllerData.pm01
+              , controllerData.pm25, controllerData.pm10
+              , FixedPoint::millivoltsFromRaw(controllerData.voltageRaw, controllerData.millivoltsPerCount), flags }
+    };
+}
+
+void DustMonitorController::queueStreamingSample(const BatchCodec::Sample& sample)
+{
+    if (streamingSamplesCount == streamingSamples.size())
+    {
+        WAKE_LOG("Streaming backlog is full, dropping the oldest sample")
+        std::move(streamingSamples.begin() + 1, streamingSamples.end(), streamingSamples.begin());
+        --streamingSamplesCount;
+    }
+    streamingSamples[streamingSamplesCount++] = sample;
+}
+
+void DustMonitorController::flushStreamingSamples()
+{
+    while (streamingSamplesCount > 0)
+    {
+        std::array<uint8_t, BatchCodec::maxFrameSize> frame;
+        size_t size = 0;
+        const auto encoded = BatchCodec::encode(streamingSamples.data(), streamingSamplesCount, BatchCodec::Options::FixedPoint
+                                                , frame.data(), frame.size(), size);
+        if (encoded == 0 || !transport.sendBatch(frame.data(), size))
         {
-            DEBUG_LOG("Starting PM measurement")
-            HardwareSensorControl::switchStepUpConversion(true);
-            dustData.startMeasure();
-            controllerData.sps30Status = SPS30Status::Measuring;
-            HardwareSensorControl::holdStepUpConversion();
-            controllerData.voltageRaw = readVoltageRaw();
-            controllerData.lastPMMeasureStarted = time(nullptr);
+            // Kept for the next flush
+            WAKE_LOG("Batch frame is not delivered, %u samples pending", static_cast<unsigned>(streamingSamplesCount))
+            return;
         }
+        std::move(streamingSamples.begin() + encoded, streamingSamples.begin() + streamingSamplesCount, streamingSamples.begin());
+        streamingSamplesCount -= encoded;
     }
 }
 
 bool DustMonitorController::hibernate()
 {
+    finishSPS30Commands();
+    WAKE_PHASE(Hibernate)
     dustData.hibernate();
+    memoryMonitor.sample();
     transport.hibernate();
-    return storage.set(controllerDataTag, controllerData);
+    ota.hibernate();
+    memoryMonitor.hibernate();
+    deadline.hibernate();
+    static_assert(sizeof(ControllerData) <= PersistentLayout::budgetOf(controllerDataTag), "Controller record exceeds its budget");
+    static_assert(sizeof(WakeScheduler::State) <= PersistentLayout::budgetOf(schedulerDataTag), "Wake schedule exceeds its budget");
+    const bool scheduleSaved = PersistentLayout::store(storage, schedulerDataTag, scheduler.getState());
+    return PersistentLayout::store(storage, controllerDataTag, controllerData) && scheduleSaved;
 }
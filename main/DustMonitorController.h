@@ -1,8 +1,14 @@
 #pragma once
 
+#include "BatchCodec.h"
 #include "PTHProvider.h"
 #include "EspNowTransport.h"
+#include "MemoryMonitor.h"
+#include "OtaUpdater.h"
 #include "SPS30DataProvider.h"
+#include "WakeDeadline.h"
+#include "WakeScheduler.h"
+#include "WakeSequence.h"
 
 #include <esp_attr.h>
 #include <cstdint>
@@ -21,14 +27,35 @@ public:
     , meteoData(storage, i2CHelper)
     , dustData(storage, uart)
     , transport(storage, restrictTxPower)
+    , ota(storage)
+    , memoryMonitor(storage)
+    , deadline(storage)
     {}
 
     bool setup(ResetReason resetReason);
     uint32_t process();
+    // True when the external power is detected and the wake shall continue with stream()
+    bool isStreaming() const { return controllerData.externalPower; }
+    // Streams the measurements while on the external power, returns the deep sleep time as process() does
+    uint32_t stream();
     bool hibernate();
+    bool isRestartRequired() const { return ota.isRestartRequired(); }
 
 private:
+    // Probes the SPS30 not found before, powering it for the probe
+    void probeSPS30(time_t now);
     void processSPS30Measurement();
+    bool isJobDue(WakeScheduler::JobId job) const { return (dueJobs & WakeScheduler::maskOf(job)) != 0; }
+    // PM measurement: the start when the scheduler has it due, the readout 30 s later
+    SequenceState measurePM(SequenceFrame& frame);
+    void collectSPS30Measurement();
+    void finishSPS30Commands();
+    void reportDiagnostics();
+    bool readExternalPower() const;
+    void updatePowerSource();
+    BatchCodec::Sample takeStreamingSample();
+    void queueStreamingSample(const BatchCodec::Sample& sample);
+    void flushStreamingSamples();
 
 
     enum class SPS30Status
@@ -47,13 +74,27 @@ private:
         uint16_t voltageRaw = 0;
         char sps30Serial[32] = {};
         time_t lastPMMeasureStarted = 0;
+        SequenceFrame pmSequence;
         time_t firstSyncTime = 0;
         bool insufficientPower = false;
+        bool externalPower = false;
+        // Consecutive readings disagreeing with the current power source
+        uint8_t powerSourceReadings = 0;
+        // Battery reading conversion derived from the configuration: mV per ADC count in Q16, the threshold in mV
+        uint32_t millivoltsPerCount = 0;
+        int32_t externalPowerMillivolts = 0;
     } controllerData;
     embedded::PersistentStorage& storage;
     PTHProvider meteoData;
     SPS30DataProvider dustData;
     EspNowTransport transport;
+    OtaUpdater ota;
+    MemoryMonitor memoryMonitor;
+    WakeDeadline deadline;
+    WakeScheduler scheduler;
+    WakeScheduler::JobMask dueJobs = 0;
     bool needSend = false;
     bool sensorPresent = false;
+    bool sps30ReadoutPending = false;
+    bool sps30PowerOffPending = false;
 };
@@ -1,26 +1,84 @@
 #include "EspNowTransport.h"
 
 #include "AppConfig.h"
+#include "PersistentLayout.h"
+#include "SensorTrace.h"
 #include "TimeFunctions.h"
+#include "WakeDeadline.h"
 
 #include "PersistentStorage.h"
 #include "Delays.h"
 
 #include <esp_now.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
-#include <variant>
-#include <freertos/task.h>
+#include <freertos/FreeRTOS.h>
+#include <nvs.h>
 #include <freertos/event_groups.h>
+#include <algorithm>
 
+#include "BinaryLog.h"
 #include "Debug.h"
 
 namespace
 {
 
-enum class EventType {DataReady, SendCallback, ReceiveCallback, Exit};
-
 constexpr std::string_view transportDataTag = "ESPN";
+constexpr std::string_view routeDataTag = "ROUT";
 constexpr suseconds_t firstAttemptMicroseconds = 800000;
+constexpr uint64_t retryDelayMicroseconds = 100000;
+constexpr int otaWindowMilliseconds = 200;
+constexpr int deliveryStatusMilliseconds = 50;
+// The units of the same minute slot arrive within this time and share a relay frame
+constexpr int relayAggregationMilliseconds = 300;
+constexpr int relayForwardAttempts = 3;
+// The indoor unit answers the key request right away
+constexpr int keyExchangeMilliseconds = 100;
+// The sequence numbers are reserved in the flash in blocks, a write every 1024 records (17 hours of the minute
+// wakes); after a reset the numbering continues past the block, so the receiver never sees a number twice
+constexpr const char* sequenceNamespace = "espnow";
+constexpr const char* sequenceKey = "sequence";
+constexpr uint32_t sequenceBlock = 1024;
+
+constexpr EventBits_t sendFinishedBit = BIT1;
+constexpr EventBits_t correctionReceivedBit = BIT2;
+constexpr EventBits_t otaChunksReceivedBit = BIT3;
+constexpr EventBits_t auxiliaryFailedBit = BIT4;
+constexpr EventBits_t auxiliarySentBit = BIT5;
+constexpr EventBits_t relayRecordBit = BIT6;
+constexpr EventBits_t keyAnnouncedBit = BIT7;
+constexpr EventBits_t relayReplySentBit = BIT8;
+
+uint32_t loadSequenceLimit()
+{
+    nvs_handle_t handle;
+    if (nvs_open(sequenceNamespace, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return 0;
+    }
+    uint32_t limit = 0;
+    nvs_get_u32(handle, sequenceKey, &limit);
+    nvs_close(handle);
+    return limit;
+}
+
+void storeSequenceLimit(uint32_t limit)
+{
+    nvs_handle_t handle;
+    if (nvs_open(sequenceNamespace, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return;
+    }
+    if (const auto result = nvs_set_u32(handle, sequenceKey, limit); result == ESP_OK)
+    {
+        nvs_commit(handle);
+    }
+    else
+    {
+        DEBUG_LOG("Sequence block is not stored: " << esp_err_to_name(result))
+    }
+    nvs_close(handle);
+}
 
 void initWiFi()
 {
@@ -37,257 +95,686 @@ struct CorrectionMessage
 {
     int64_t currentTime;
     int64_t receiveTime;
+    // Sequence number of the answered record, so an old reply can't be replayed into a later exchange
+    uint32_t sequence;
+    uint32_t reserved;
+    // SessionKeys::correctionTag() of the reply, so it can't be forged
+    SessionKeys::CorrectionTag tag;
 };
 
-struct EventData
+// Without the tag, accepted only while the link is not encrypted
+struct UntaggedCorrectionMessage
 {
-    EventType type = EventType::Exit;
-    std::array<uint8_t, 6> macAddr = {};
-    std::variant<int64_t, esp_now_send_status_t> data;
+    int64_t currentTime;
+    int64_t receiveTime;
+    uint32_t sequence;
+    uint32_t reserved;
+};
+
+// Without the sequence number either
+struct LegacyCorrectionMessage
+{
+    int64_t currentTime;
+    int64_t receiveTime;
 };
 
 volatile uint64_t lastPacketMicroseconds = 0;
 volatile int64_t lastPacketTimestamp = 0;
 volatile uint64_t responseMicroseconds = 0;
-auto espnowQueue = std::unique_ptr<std::remove_pointer_t<QueueHandle_t>, decltype(&vQueueDelete)>(nullptr, &vQueueDelete);
+// Route of the last attempt, the only address its correction is accepted from
+const uint8_t* volatile replyAddress = nullptr;
+std::array<uint8_t, 6> ownAddress {};
+constexpr int8_t unknownRssi = 0;
+volatile int8_t replyRssi = unknownRssi;
+
+// The transport is driven by the ESP-NOW callbacks and the one-shot timer; the caller only waits for the result
+EspNowTransport* activeTransport = nullptr;
+StaticEventGroup_t espnowEventGroupBuffer;
 EventGroupHandle_t espnowEventGroup = nullptr;
+esp_timer_handle_t sendTimer = nullptr;
+portMUX_TYPE transportLock = portMUX_INITIALIZER_UNLOCKED;
+
+volatile bool otaOfferReceived = false;
+OtaProtocol::OfferMessage otaOffer {};
+std::array<OtaProtocol::ChunkMessage, OtaProtocol::chunksPerWake> otaChunks {};
+volatile uint32_t otaSessionId = 0;
+volatile uint32_t otaFirstChunk = 0;
+volatile uint8_t otaExpectedChunks = 0;
+volatile uint32_t otaReceivedMask = 0;
+// What each frame waiting for its delivery callback is, the callbacks come in the order of the sends
+enum class SendKind : uint8_t
+{
+    Measurement,
+    // An OTA request, a diagnostics report or a batch frame
+    Auxiliary,
+    RelayReply,
+    KeyRequest,
+};
+std::array<SendKind, 8> sendsInFlight {};
+size_t firstSendInFlight = 0;
+size_t sendsInFlightCount = 0;
+
+// The indoor unit first, then the configured relays
+static_assert(std::tuple_size_v<decltype(AppConfig::relayAddresses)> < RouteSelector::maxRoutes, "Too many relays");
+std::array<const uint8_t*, RouteSelector::maxRoutes> routeAddresses {};
+size_t routeCount = 0;
+
+KeyExchange::EpochAnnounceMessage keyAnnounce {};
+
+// A measurement message received as a relay, answered by the main task
+struct RelayInboxEntry
+{
+    std::array<uint8_t, 6> source;
+    int64_t receiveTime;
+    MeasurementMessage record;
+};
+
+volatile bool relayEnabled = false;
+// Filled by the receive callback; a record not fitting is retried by its unit
+std::array<RelayInboxEntry, 4> relayInbox {};
+size_t relayInboxCount = 0;
+// Records of the other units answered by the relay, waiting to be forwarded; used by the main task only
+std::array<MeasurementMessage, 8> relayQueue {};
+size_t relayQueued = 0;
+
+void collectRoutes()
+{
+    routeCount = 0;
+    routeAddresses[routeCount++] = AppConfig::macAddress.data();
+    for (const auto& relay : AppConfig::relayAddresses)
+    {
+        if (std::any_of(relay.begin(), relay.end(), [](uint8_t byte) { return byte != 0; }))
+        {
+            routeAddresses[routeCount++] = relay.data();
+        }
+    }
+}
+
+// Adds the peer or changes its encryption; the local master key is null for an unencrypted peer
+esp_err_t addPeer(const uint8_t* address, const uint8_t* localKey = nullptr)
+{
+    esp_now_peer_info_t peerInfo;
+    memset(&peerInfo, 0, sizeof(peerInfo));
+    static_assert(sizeof(peerInfo.peer_addr) == sizeof(AppConfig::macAddress), "MAC address size mismatch");
+    memcpy(peerInfo.peer_addr, address, sizeof(peerInfo.peer_addr));
+    peerInfo.channel = 0;
+    peerInfo.encrypt = localKey != nullptr;
+    if (localKey != nullptr)
+    {
+        static_assert(sizeof(peerInfo.lmk) == SessionKeys::keySize, "Key size mismatch");
+        memcpy(peerInfo.lmk, localKey, sizeof(peerInfo.lmk));
+    }
+    peerInfo.ifidx = WIFI_IF_STA;
+    return esp_now_is_peer_exist(address) ? esp_now_mod_peer(&peerInfo) : esp_now_add_peer(&peerInfo);
+}
+
+esp_err_t sendFrame(const uint8_t* address, const uint8_t* data, size_t size, SendKind kind)
+{
+    portENTER_CRITICAL(&transportLock);
+    const bool tracked = sendsInFlightCount < sendsInFlight.size();
+    if (tracked)
+    {
+        sendsInFlight[(firstSendInFlight + sendsInFlightCount++) % sendsInFlight.size()] = kind;
+    }
+    portEXIT_CRITICAL(&transportLock);
+    const auto result = esp_now_send(address, data, size);
+    if (result != ESP_OK && tracked)
+    {
+        // No callback comes for a frame not queued
+        portENTER_CRITICAL(&transportLock);
+        --sendsInFlightCount;
+        portEXIT_CRITICAL(&transportLock);
+    }
+    return result;
+}
+
+SendKind takeSendInFlight()
+{
+    portENTER_CRITICAL(&transportLock);
+    const auto kind = sendsInFlightCount > 0 ? sendsInFlight[firstSendInFlight] : SendKind::KeyRequest;
+    if (sendsInFlightCount > 0)
+    {
+        firstSendInFlight = (firstSendInFlight + 1) % sendsInFlight.size();
+        --sendsInFlightCount;
+    }
+    portEXIT_CRITICAL(&transportLock);
+    return kind;
+}
+
+bool isIndoorUnit(const uint8_t* address)
+{
+    return memcmp(address, AppConfig::macAddress.data(), AppConfig::macAddress.size()) == 0;
+}
+
+bool isRelayedUnit(const uint8_t* address)
+{
+    return std::any_of(AppConfig::relayedUnits.begin(), AppConfig::relayedUnits.end(), [address](const auto& unit) {
+        return std::any_of(unit.begin(), unit.end(), [](uint8_t byte) { return byte != 0; })
+               && memcmp(address, unit.data(), unit.size()) == 0;
+    });
+}
+
+uint32_t readMagic(const uint8_t* data, int dataLength)
+{
+    uint32_t magic = 0;
+    if (dataLength >= static_cast<int>(sizeof(magic)))
+    {
+        memcpy(&magic, data, sizeof(magic));
+    }
+    return magic;
+}
+
+void storeOtaChunk(const uint8_t* data)
+{
+    OtaProtocol::ChunkMessage chunk;
+    memcpy(&chunk, data, sizeof(chunk));
+    const auto slot = chunk.chunkIndex - otaFirstChunk;
+    if (chunk.sessionId != otaSessionId || slot >= otaExpectedChunks || chunk.length > OtaProtocol::maxChunkPayload)
+    {
+        return;
+    }
+    otaChunks[slot] = chunk;
+    otaReceivedMask = otaReceivedMask | (1u << slot);
+    if (otaReceivedMask == (1u << otaExpectedChunks) - 1)
+    {
+        xEventGroupSetBits(espnowEventGroup, otaChunksReceivedBit);
+    }
+}
 
-void onDataSent(const uint8_t* macAddr, esp_now_send_status_t status)
+void onDataSent(const uint8_t* /*macAddr*/, esp_now_send_status_t status)
 {
-    EventData evt;
-    evt.type = EventType::SendCallback;
-    memcpy(evt.macAddr.begin(), macAddr, evt.macAddr.size());
-    evt.data = status;
-    xQueueSend(espnowQueue.get(), &evt, portMAX_DELAY);
+    // A late status of the measurement frame is told apart from the status of the auxiliary frame sent after it
+    switch (takeSendInFlight())
+    {
+        case SendKind::Measurement:
+            if (activeTransport != nullptr)
+            {
+                activeTransport->onSendResult(status == ESP_NOW_SEND_SUCCESS);
+            }
+            break;
+        case SendKind::Auxiliary:
+            xEventGroupSetBits(espnowEventGroup, status == ESP_NOW_SEND_SUCCESS ? auxiliarySentBit : auxiliaryFailedBit);
+            break;
+        case SendKind::RelayReply:
+            xEventGroupSetBits(espnowEventGroup, relayReplySentBit);
+            break;
+        case SendKind::KeyRequest:
+            break;
+    }
+}
+
+void receiveRelayed(const uint8_t* source, const uint8_t* data)
+{
+    const auto receiveTime = microsecondsNow();
+    if (!isRelayedUnit(source))
+    {
+        return;
+    }
+    portENTER_CRITICAL(&transportLock);
+    if (relayInboxCount < relayInbox.size())
+    {
+        auto& entry = relayInbox[relayInboxCount++];
+        memcpy(entry.source.data(), source, entry.source.size());
+        entry.receiveTime = receiveTime;
+        memcpy(&entry.record, data, sizeof(entry.record));
+    }
+    portEXIT_CRITICAL(&transportLock);
+    xEventGroupSetBits(espnowEventGroup, relayRecordBit);
+}
+
+void replyRelayed(const RelayInboxEntry& entry)
+{
+    // The relayed units are peers only for their reply, the peer table holds about 20 entries
+    const bool knownPeer = esp_now_is_peer_exist(entry.source.data());
+    if (!knownPeer && addPeer(entry.source.data()) != ESP_OK)
+    {
+        return;
+    }
+    CorrectionMessage reply {
+            .currentTime = microsecondsNow(), .receiveTime = entry.receiveTime, .sequence = entry.record.sequence, .reserved = 0
+            , .tag = {}
+    };
+    reply.tag = SessionKeys::correctionTag(reply.sequence, reply.receiveTime, reply.currentTime, entry.source.data());
+    xEventGroupClearBits(espnowEventGroup, relayReplySentBit);
+    if (sendFrame(entry.source.data(), reinterpret_cast<const uint8_t*>(&reply), sizeof(reply), SendKind::RelayReply) == ESP_OK)
+    {
+        xEventGroupWaitBits(espnowEventGroup, relayReplySentBit, pdTRUE, pdFALSE, pdMS_TO_TICKS(deliveryStatusMilliseconds));
+    }
+    if (!knownPeer)
+    {
+        esp_now_del_peer(entry.source.data());
+    }
+}
+
+// Returns false for a retry after a lost correction
+bool queueRelayed(const MeasurementMessage& record)
+{
+    const bool duplicate = std::any_of(relayQueue.begin(), relayQueue.begin() + relayQueued, [&record](const auto& queued) {
+        return queued.sequence == record.sequence && memcmp(queued.spsSerial, record.spsSerial, sizeof(record.spsSerial)) == 0;
+    });
+    if (duplicate)
+    {
+        return false;
+    }
+    if (relayQueued == relayQueue.size())
+    {
+        std::move(relayQueue.begin() + 1, relayQueue.end(), relayQueue.begin());
+        --relayQueued;
+    }
+    relayQueue[relayQueued++] = record;
+    return true;
+}
+
+// Answers the received records from the main task, returns true when new records are queued
+bool answerRelayed()
+{
+    bool queued = false;
+    while (true)
+    {
+        RelayInboxEntry entry;
+        portENTER_CRITICAL(&transportLock);
+        const bool pending = relayInboxCount > 0;
+        if (pending)
+        {
+            entry = relayInbox[0];
+            std::move(relayInbox.begin() + 1, relayInbox.begin() + relayInboxCount, relayInbox.begin());
+            --relayInboxCount;
+        }
+        portEXIT_CRITICAL(&transportLock);
+        if (!pending)
+        {
+            return queued;
+        }
+        replyRelayed(entry);
+        queued = queueRelayed(entry.record) || queued;
+    }
 }
 
 #if __GNUC__ >= 9
 void onDataReceive(const esp_now_recv_info_t * esp_now_info, const uint8_t *data, int data_len)
 {
     const auto mac_addr = esp_now_info->src_addr;
+    if (esp_now_info->rx_ctrl != nullptr)
+    {
+        replyRssi = static_cast<int8_t>(esp_now_info->rx_ctrl->rssi);
+    }
 #else
 void onDataReceive(const uint8_t * mac_addr, const uint8_t *data, int data_len)
 {
 #endif
-    if (data_len == sizeof(CorrectionMessage))
+    if (data_len == sizeof(CorrectionMessage)
+        || ((data_len == sizeof(UntaggedCorrectionMessage) || data_len == sizeof(LegacyCorrectionMessage))
+            && !AppConfig::encryptEspNow))
     {
-        union
+        const auto receivedMicroseconds = embedded::getMicrosecondTicks();
+        CorrectionMessage correctionMessage {};
+        memcpy(&correctionMessage, data, data_len);
+        const auto expectedAddress = replyAddress;
+        if (activeTransport == nullptr || expectedAddress == nullptr || memcmp(mac_addr, expectedAddress, ownAddress.size()) != 0)
+        {
+            WAKE_LOG("Correction from another address is ignored")
+            return;
+        }
+        if (data_len != sizeof(LegacyCorrectionMessage) && correctionMessage.sequence != activeTransport->getSequence())
+        {
+            WAKE_LOG("Correction for another record is ignored")
+            return;
+        }
+        if (data_len == sizeof(CorrectionMessage)
+            && !SessionKeys::verifyCorrection(correctionMessage.tag, correctionMessage.sequence, correctionMessage.receiveTime
+                                              , correctionMessage.currentTime, ownAddress.data()))
         {
-            CorrectionMessage correctionMessage;
-            std::array<uint8_t, sizeof(CorrectionMessage)> bytes;
-        } correctionData;
-
-        responseMicroseconds = embedded::getMicrosecondTicks();
-        memcpy(correctionData.bytes.begin(), data, data_len);
-        const auto &remoteReceivedTime = correctionData.correctionMessage.receiveTime;
-        const auto &remoteSentTime = correctionData.correctionMessage.currentTime;
+            WAKE_LOG("Correction with a wrong tag is ignored")
+            return;
+        }
+        responseMicroseconds = receivedMicroseconds;
+        const auto &remoteReceivedTime = correctionMessage.receiveTime;
+        const auto &remoteSentTime = correctionMessage.currentTime;
         const auto remoteDelta = remoteSentTime - remoteReceivedTime;
         const auto localDelta = static_cast<int64_t>(responseMicroseconds - lastPacketMicroseconds);
 
         const auto correctionFactor = (localDelta - remoteDelta) / 2;
         const int64_t rtcCorrection = remoteReceivedTime - lastPacketTimestamp - correctionFactor;
-        EventData evt {
-                .type = EventType::ReceiveCallback, .data = rtcCorrection
-        };
-        std::memcpy(evt.macAddr.begin(), mac_addr, evt.macAddr.size());
-        xQueueSend(espnowQueue.get(), &evt, portMAX_DELAY);
+        activeTransport->onCorrection(rtcCorrection);
+    }
+    else if (data_len == sizeof(KeyExchange::EpochAnnounceMessage) && isIndoorUnit(mac_addr)
+             && readMagic(data, data_len) == KeyExchange::announceMagic)
+    {
+        memcpy(&keyAnnounce, data, sizeof(keyAnnounce));
+        xEventGroupSetBits(espnowEventGroup, keyAnnouncedBit);
+    }
+    else if (relayEnabled && data_len == sizeof(MeasurementMessage))
+    {
+        receiveRelayed(mac_addr, data);
+    }
+    else if (data_len == sizeof(OtaProtocol::OfferMessage) && isIndoorUnit(mac_addr)
+             && readMagic(data, data_len) == OtaProtocol::offerMagic)
+    {
+        memcpy(&otaOffer, data, sizeof(otaOffer));
+        otaOfferReceived = true;
+    }
+    else if (data_len == sizeof(OtaProtocol::ChunkMessage) && isIndoorUnit(mac_addr)
+             && readMagic(data, data_len) == OtaProtocol::chunkMagic)
+    {
+        storeOtaChunk(data);
     }
     else
     {
-        DEBUG_LOG("Received unexpected data length " << data_len << " from " << embedded::BytesView(const_cast<uint8_t*>(mac_addr), 6) << " expected " << sizeof(CorrectionMessage) << " bytes")
+        WAKE_LOG("Received unexpected data length %d from %02x:%02x:%02x:%02x:%02x:%02x", data_len
+                 , mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5])
     }
 }
 
-void espnowTask(void *pvParameter)
+void onSendTimer(void* parameter)
 {
-    auto* transport = reinterpret_cast<EspNowTransport*>(pvParameter);
-    transport->threadFunction();
+    static_cast<EspNowTransport*>(parameter)->onTimer();
 }
 
-[[noreturn]] void delayedSend(void* /*pvParameter*/)
+} // namespace
+
+bool EspNowTransport::setup(embedded::CharView serial, bool wakeUp)
 {
-    while(true)
+    sps30Serial = serial;
+    bool statsRestored = false;
+    if (wakeUp)
+    {
+        if (auto storedStats = storage.get<DeliveryStats>(transportDataTag))
+        {
+            stats = *storedStats;
+            statsRestored = true;
+        }
+    }
+    if (!statsRestored)
+    {
+        // The numbers up to the reserved limit may have been sent before the reset
+        stats.sequence = stats.sequenceLimit = loadSequenceLimit();
+    }
+    link.setup(wakeUp);
+    keys.setup(wakeUp);
+    collectRoutes();
+    router = RouteSelector(routeCount);
+    if (wakeUp)
     {
-        if (xEventGroupWaitBits(espnowEventGroup, BIT0, pdTRUE, pdTRUE, portMAX_DELAY) == BIT0)
+        if (auto routeState = storage.get<RouteSelector::State>(routeDataTag))
         {
-            embedded::delay(100);
-            EventData evt { .type = EventType::DataReady, .data = 0 };
-            xQueueSend(espnowQueue.get(), &evt, portMAX_DELAY);
+            router.restore(*routeState);
         }
     }
+    activeTransport = this;
+    espnowEventGroup = xEventGroupCreateStatic(&espnowEventGroupBuffer);
+    const esp_timer_create_args_t timerArgs {
+            .callback = onSendTimer, .arg = this, .dispatch_method = ESP_TIMER_TASK, .name = "espnowSend"
+            , .skip_unhandled_events = false
+    };
+    // Once per boot: every wake boots anew, the streaming keeps the timer of its first wake
+    return sendTimer != nullptr || esp_timer_create(&timerArgs, &sendTimer) == ESP_OK;
 }
 
-} // namespace
-
+void EspNowTransport::onTimer()
+{
+    bool transmitRequired = false;
+    portENTER_CRITICAL(&transportLock);
+    if (sendStatus == SendStatus::Scheduled)
+    {
+        sendStatus = SendStatus::Requested;
+        transmitRequired = true;
+    }
+    portEXIT_CRITICAL(&transportLock);
+    if (transmitRequired)
+    {
+        transmit();
+    }
+}
 
-void EspNowTransport::threadFunction()
-{
-    EventData evt;
-    while (xQueueReceive(espnowQueue.get(), &evt, portMAX_DELAY) == pdTRUE) {
-        switch (evt.type) {
-            case EventType::DataReady:
-                if (attemptsCounter == 0)
-                {
-                    timeval lastPacketTime;
-                    gettimeofday(&lastPacketTime, nullptr);
-                    if (lastPacketTime.tv_usec < firstAttemptMicroseconds)
-                    {
-                        embedded::delay((firstAttemptMicroseconds - lastPacketTime.tv_usec) / 1000);
-                    }
-                }
-                sendData();
-                break;
-            case EventType::SendCallback:
-                if (std::holds_alternative<esp_now_send_status_t>(evt.data))
-                {
-                     if (const auto status = std::get<esp_now_send_status_t>(evt.data); status != ESP_NOW_SEND_SUCCESS)
-                     {
-                         DEBUG_LOG("Last Packet delivery to " << embedded::BytesView(evt.macAddr) << " fail")
-                         if (attemptsCounter < maxAttempts)
-                         {
-                             DEBUG_LOG("Retrying to send packet to " << embedded::BytesView(evt.macAddr) << " attempt " << (attemptsCounter + 1))
-                             xEventGroupSetBits(espnowEventGroup, BIT0);
-                         }
-                         else
-                         {
-                             DEBUG_LOG("Max delivery attempts to " << embedded::BytesView(evt.macAddr) << " reached")
-                             sendStatus = SendStatus::Failed;
-                             xEventGroupSetBits(espnowEventGroup, BIT1);
-                         }
-                     }
-                     else
-                     {
-                         sendStatus = SendStatus::Awaiting;
-                         DEBUG_LOG("Last packet successfully sent to " << embedded::BytesView(evt.macAddr) << " from " << attemptsCounter << " attempt")
-                     }
-                }
-                break;
-            case EventType::ReceiveCallback:
-                if (std::holds_alternative<int64_t>(evt.data))
-                {
-                    rtcCorrection = std::get<int64_t>(evt.data);
-                    sendStatus = EspNowTransport::SendStatus::Completed;
-                    xEventGroupSetBits(espnowEventGroup, BIT2);
-                }
-                break;
-            case EventType::Exit:
-                return;
+void EspNowTransport::onSendResult(bool delivered)
+{
+    bool finished = false;
+    bool retry = false;
+    portENTER_CRITICAL(&transportLock);
+    if (sendStatus == SendStatus::Requested)
+    {
+        if (!delivered)
+        {
+            ++stats.failures;
+        }
+        if (delivered)
+        {
+            sendStatus = SendStatus::Awaiting;
+        }
+        else if (attemptsCounter < maxAttempts)
+        {
+            sendStatus = SendStatus::Scheduled;
+            retry = true;
+        }
+        else
+        {
+            sendStatus = SendStatus::Failed;
+            finished = true;
         }
     }
+    portEXIT_CRITICAL(&transportLock);
+    if (retry)
+    {
+        WAKE_LOG("Retrying to send packet, attempt %d", attemptsCounter + 1)
+        esp_timer_start_once(sendTimer, retryDelayMicroseconds);
+    }
+    else if (finished)
+    {
+        WAKE_LOG("Max delivery attempts reached")
+        xEventGroupSetBits(espnowEventGroup, sendFinishedBit);
+    }
+    else if (delivered)
+    {
+        WAKE_LOG("Last packet successfully sent from %d attempt", attemptsCounter)
+    }
 }
 
-bool EspNowTransport::setup(embedded::CharView serial, bool /*wakeUp*/)
+void EspNowTransport::onCorrection(int64_t correction)
 {
-    sps30Serial = serial;
-    espnowQueue.reset(xQueueCreate(6, sizeof(EventData)));
-    espnowEventGroup = xEventGroupCreate();
-    xTaskCreate(espnowTask, "espnowTask", 2048, this, 4, nullptr);
-    xTaskCreate(delayedSend, "delayedSend", 1024, nullptr, 4, nullptr);
-    return true;
+    portENTER_CRITICAL(&transportLock);
+    // The delivery callback may come after the response
+    const bool expected = sendStatus == SendStatus::Awaiting || sendStatus == SendStatus::Requested;
+    if (expected)
+    {
+        rtcCorrection = correction;
+        sendStatus = SendStatus::Completed;
+    }
+    portEXIT_CRITICAL(&transportLock);
+    if (expected)
+    {
+        xEventGroupSetBits(espnowEventGroup, sendFinishedBit | correctionReceivedBit);
+    }
 }
 
-bool EspNowTransport::prepareEspNow()
+bool EspNowTransport::prepare()
 {
     if (espNowPrepared)
     {
         return true;
     }
+    sendsInFlightCount = 0;
     initWiFi();
-    if (restrictTxPower)
+    if (AppConfig::allowLongRange)
     {
-        esp_wifi_set_max_tx_power(34);
+        esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR);
     }
+    applyLinkProfile();
 
     if (esp_now_init() != ESP_OK)
     {
         DEBUG_LOG("Error initializing ESP-NOW")
         return false;
     }
-    if (espnowQueue == nullptr) {
-        DEBUG_LOG("Failed to create event queue")
+    if (const auto result = esp_wifi_get_mac(WIFI_IF_STA, ownAddress.data()); result != ESP_OK)
+    {
+        DEBUG_LOG("Failed to read the MAC address: " << esp_err_to_name(result))
         return false;
     }
     esp_now_register_send_cb(onDataSent);
     esp_now_register_recv_cb(onDataReceive);
+    if (AppConfig::encryptEspNow)
+    {
+        const auto primaryKey = keys.primaryKey();
+        esp_now_set_pmk(primaryKey.data());
+    }
 
-    // Register peer
-    esp_now_peer_info_t peerInfo;
-    memset(&peerInfo, 0, sizeof(peerInfo));
-    static_assert(sizeof(peerInfo.peer_addr) == sizeof(AppConfig::macAddress), "MAC address size mismatch");
-    memcpy(peerInfo.peer_addr, AppConfig::macAddress.begin(), AppConfig::macAddress.size());
-    peerInfo.channel = 0;
-    peerInfo.encrypt = false;
-    peerInfo.ifidx = WIFI_IF_STA;
-
-    // Add peer
-    if (auto result = esp_now_add_peer(&peerInfo); result != ESP_OK)
+    for (size_t route = 0; route < routeCount; ++route)
     {
-        DEBUG_LOG("Failed to add peer: " << esp_err_to_name(result))
-        return false;
+        // The relays don't know their units in advance, so only the indoor unit link is encrypted
+        const bool encrypted = route == RouteSelector::directRoute && AppConfig::encryptEspNow && keys.isEstablished();
+        if (auto result = addPeer(routeAddresses[route], encrypted ? keys.localKey().data() : nullptr); result != ESP_OK)
+        {
+            DEBUG_LOG("Failed to add peer: " << esp_err_to_name(result))
+            return false;
+        }
     }
 
     espNowPrepared = true;
     return true;
 }
 
-bool EspNowTransport::sendData(const Data &transportData)
+void EspNowTransport::applyLinkProfile()
+{
+    const auto profile = link.getProfile();
+    esp_wifi_set_max_tx_power(profile.txPower);
+    if (const auto result = esp_wifi_config_espnow_rate(WIFI_IF_STA, profile.rate); result != ESP_OK)
+    {
+        WAKE_LOG("Failed to set ESP-NOW rate %d: 0x%x", static_cast<int>(profile.rate), result)
+    }
+}
+
+bool EspNowTransport::sendData(const Data &transportData, int timeoutMilliseconds)
 {
     data = transportData;
-    if (prepareEspNow())
+    sampleTimestamp = microsecondsNow();
+    if (++stats.sequence > stats.sequenceLimit)
+    {
+        stats.sequenceLimit = stats.sequence - 1 + sequenceBlock;
+        storeSequenceLimit(stats.sequenceLimit);
+    }
+    attemptsCounter = 0;
+    // A relay is in reach of the indoor unit by definition
+    route = relayEnabled ? RouteSelector::directRoute : router.select();
+    routeAttempts = 0;
+    if (prepare() && (!AppConfig::encryptEspNow || keys.isEstablished() || establishKeys()))
     {
-        EventData evt { .type = EventType::DataReady, .data = 0 };
-        xQueueSend(espnowQueue.get(), &evt, portMAX_DELAY);
-        if (xEventGroupWaitBits(espnowEventGroup, BIT1 | BIT2, pdFALSE, pdFALSE, pdMS_TO_TICKS(1000)) == BIT2)
+        xEventGroupClearBits(espnowEventGroup, sendFinishedBit | correctionReceivedBit);
+        timeval now;
+        gettimeofday(&now, nullptr);
+        sendStatus = SendStatus::Scheduled;
+        if (now.tv_usec < firstAttemptMicroseconds)
+        {
+            esp_timer_start_once(sendTimer, firstAttemptMicroseconds - now.tv_usec);
+        }
+        else
+        {
+            onTimer();
+        }
+        if (WakeDeadline::waitBits(espnowEventGroup, sendFinishedBit, timeoutMilliseconds) & correctionReceivedBit)
         {
+            if (replyRssi != unknownRssi)
+            {
+                link.onRssi(replyRssi);
+            }
+            link.onExchange(true, attemptsCounter);
+            router.onExchange(route, true, routeAttempts);
+            if (route == RouteSelector::directRoute)
+            {
+                keys.onExchange(true, true);
+            }
+            TRACE_SENSOR(link(SensorTrace::LinkOutcome::Completed, stats.sequence, attemptsCounter, route))
             return true;
         }
     }
+    esp_timer_stop(sendTimer);
+    portENTER_CRITICAL(&transportLock);
+    // Acknowledged but not answered is not counted as dropped, the receiver has it
+    const bool acknowledged = sendStatus == SendStatus::Awaiting;
+    if (!acknowledged)
+    {
+        ++stats.dropped;
+    }
     sendStatus = SendStatus::Failed;
+    portEXIT_CRITICAL(&transportLock);
+    if (espNowPrepared)
+    {
+        link.onExchange(false, attemptsCounter);
+        router.onExchange(route, false, routeAttempts);
+        if (route == RouteSelector::directRoute)
+        {
+            keys.onExchange(acknowledged, false);
+        }
+    }
+    TRACE_SENSOR(link(acknowledged ? SensorTrace::LinkOutcome::Acknowledged : SensorTrace::LinkOutcome::Lost
+                      , stats.sequence, attemptsCounter, route))
     return false;
 }
 
-bool EspNowTransport::sendData()
+bool EspNowTransport::establishKeys()
+{
+    // The handshake goes in clear, the announce is authenticated by its tag
+    const auto indoorUnit = routeAddresses[RouteSelector::directRoute];
+    if (addPeer(indoorUnit) != ESP_OK)
+    {
+        return false;
+    }
+    xEventGroupClearBits(espnowEventGroup, keyAnnouncedBit);
+    const auto request = keys.makeRequest();
+    if (const auto result = sendFrame(indoorUnit, reinterpret_cast<const uint8_t*>(&request), sizeof(request), SendKind::KeyRequest); result != ESP_OK)
+    {
+        WAKE_LOG("Error sending key request: 0x%x", result)
+        return false;
+    }
+    const auto bits = WakeDeadline::waitBits(espnowEventGroup, keyAnnouncedBit, keyExchangeMilliseconds);
+    if (!(bits & keyAnnouncedBit) || !keys.onAnnounce(keyAnnounce, ownAddress.data()))
+    {
+        WAKE_LOG("Key exchange failed")
+        return false;
+    }
+    return addPeer(indoorUnit, keys.localKey().data()) == ESP_OK;
+}
+
+bool EspNowTransport::transmit()
 {
-    union
+    if (attemptsCounter == fallbackAttempt && link.fallBack())
     {
-        struct
+        WAKE_LOG("Falling back to the robust link profile")
+        applyLinkProfile();
+    }
+    if (attemptsCounter == routeFallbackAttempt && !relayEnabled)
+    {
+        if (const auto next = router.alternative(route); next != route)
         {
-            char spsSerial[32];
-            int16_t pm01;
-            int16_t pm25;
-            int16_t pm10;
-            float humidity;
-            float temperature;
-            float pressure;
-            float voltage;
-            int64_t timestamp;
-            uint32_t flags;
-        } message;
-        std::array<uint8_t, sizeof(message)> bytes;
-    } measurementDataMessage;
-
-    memcpy(measurementDataMessage.message.spsSerial, sps30Serial.begin(),
-           std::min(sizeof(measurementDataMessage.message.spsSerial), (std::size_t)sps30Serial.size()));
-    measurementDataMessage.message.pm01 = data.pm01;
-    measurementDataMessage.message.pm25 = data.pm25;
-    measurementDataMessage.message.pm10 = data.pm10;
-    measurementDataMessage.message.pressure = data.pressure;
-    measurementDataMessage.message.humidity = data.humidity;
-    measurementDataMessage.message.temperature = data.temperature;
-    measurementDataMessage.message.voltage = data.batteryVoltage;
-    measurementDataMessage.message.flags = data.flags;
+            WAKE_LOG("Route %d keeps failing, switching to route %d", route, next)
+            router.onExchange(route, false, routeAttempts);
+            route = next;
+            routeAttempts = 0;
+        }
+    }
+    MeasurementPacket measurementDataMessage;
+    packMeasurement(measurementDataMessage, data, std::string_view(sps30Serial.begin(), sps30Serial.size())
+                    , AppConfig::fixedPointMessage);
 
-    lastPacketMicroseconds = embedded::getMicrosecondTicks();
-    measurementDataMessage.message.timestamp = microsecondsNow();
-    lastPacketTimestamp = measurementDataMessage.message.timestamp;
     ++attemptsCounter;
-    sendStatus = SendStatus::Requested;
+    ++routeAttempts;
+    ++stats.attempts;
+    auto& message = measurementDataMessage.message;
+    message.sequence = stats.sequence;
+    message.sampleTimestamp = sampleTimestamp;
+    message.attempts = stats.attempts;
+    message.failures = stats.failures;
+    message.dropped = stats.dropped;
+
+    lastPacketMicroseconds = embedded::getMicrosecondTicks();
+    message.timestamp = microsecondsNow();
+    lastPacketTimestamp = message.timestamp;
+    replyAddress = routeAddresses[route];
 
-    if (const auto result = esp_now_send(nullptr, measurementDataMessage.bytes.begin(),
-                                   measurementDataMessage.bytes.size()); result != ESP_OK)
+    if (const auto result = sendFrame(routeAddresses[route], measurementDataMessage.bytes.begin(),
+                                      measurementDataMessage.bytes.size(), SendKind::Measurement); result != ESP_OK)
     {
-        sendStatus = SendStatus::Failed;
-        DEBUG_LOG("Error sending the data: " << esp_err_to_name(result));
+        WAKE_LOG("Error sending the data: 0x%x", result)
+        onSendResult(false);
         return false;
     }
     return true;
@@ -305,7 +792,14 @@ EspNowTransport::SendStatus EspNowTransport::getStatus() const
 
 bool EspNowTransport::hibernate()
 {
+    esp_timer_stop(sendTimer);
     sendStatus = SendStatus::Idle;
+    link.hibernate();
+    static_assert(sizeof(DeliveryStats) <= PersistentLayout::budgetOf(transportDataTag), "Delivery statistics exceed the budget");
+    PersistentLayout::store(storage, transportDataTag, stats);
+    static_assert(sizeof(RouteSelector::State) <= PersistentLayout::budgetOf(routeDataTag), "Route record exceeds its budget");
+    PersistentLayout::store(storage, routeDataTag, router.getState());
+    keys.hibernate();
     if (espNowPrepared)
     {
         esp_now_deinit();
@@ -318,3 +812,151 @@ int64_t EspNowTransport::getLastPacketTimestamp() const
 {
     return lastPacketTimestamp;
 }
+
+std::optional<OtaProtocol::OfferMessage> EspNowTransport::getOtaOffer() const
+{
+    if (!otaOfferReceived)
+    {
+        return std::nullopt;
+    }
+    return otaOffer;
+}
+
+uint8_t EspNowTransport::requestOtaChunks(uint32_t sessionId, uint32_t firstChunk, uint8_t chunkCount, OtaProtocol::SessionStatus status)
+{
+    if (!espNowPrepared)
+    {
+        return 0;
+    }
+    chunkCount = std::min(chunkCount, OtaProtocol::chunksPerWake);
+    otaSessionId = sessionId;
+    otaFirstChunk = firstChunk;
+    otaReceivedMask = 0;
+    otaExpectedChunks = chunkCount;
+    xEventGroupClearBits(espnowEventGroup, otaChunksReceivedBit | auxiliaryFailedBit | auxiliarySentBit);
+
+    const OtaProtocol::RequestMessage request {
+            .magic = OtaProtocol::requestMagic, .sessionId = sessionId, .firstChunk = firstChunk
+            , .chunkCount = chunkCount, .status = status
+    };
+    if (const auto result = sendFrame(AppConfig::macAddress.data(), reinterpret_cast<const uint8_t*>(&request), sizeof(request)
+                                      , SendKind::Auxiliary); result != ESP_OK)
+    {
+        otaExpectedChunks = 0;
+        DEBUG_LOG("Error sending OTA request: " << esp_err_to_name(result))
+        return 0;
+    }
+    const auto waitBits = chunkCount == 0 ? (auxiliaryFailedBit | auxiliarySentBit) : (otaChunksReceivedBit | auxiliaryFailedBit);
+    const auto waitTime = chunkCount == 0 ? deliveryStatusMilliseconds : otaWindowMilliseconds;
+    xEventGroupWaitBits(espnowEventGroup, waitBits, pdTRUE, pdFALSE, pdMS_TO_TICKS(waitTime));
+    otaExpectedChunks = 0;
+
+    uint8_t received = 0;
+    while (received < chunkCount && (otaReceivedMask & (1u << received)))
+    {
+        ++received;
+    }
+    WAKE_LOG("OTA chunks received: %d of %d", received, chunkCount)
+    return received;
+}
+
+bool EspNowTransport::sendDiagnostics(const DiagnosticsMessage& message)
+{
+    return sendAuxiliary(reinterpret_cast<const uint8_t*>(&message), sizeof(message));
+}
+
+bool EspNowTransport::sendBatch(const uint8_t* frame, size_t size)
+{
+    return sendAuxiliary(frame, size);
+}
+
+bool EspNowTransport::sendAuxiliary(const uint8_t* frame, size_t size)
+{
+    if (!espNowPrepared)
+    {
+        return false;
+    }
+    xEventGroupClearBits(espnowEventGroup, auxiliaryFailedBit | auxiliarySentBit);
+    if (const auto result = sendFrame(AppConfig::macAddress.data(), frame, size, SendKind::Auxiliary); result != ESP_OK)
+    {
+        WAKE_LOG("Error sending %u bytes frame: 0x%x", static_cast<unsigned>(size), result)
+        return false;
+    }
+    const auto bits = xEventGroupWaitBits(espnowEventGroup, auxiliaryFailedBit | auxiliarySentBit, pdTRUE, pdFALSE,
+                                          pdMS_TO_TICKS(deliveryStatusMilliseconds));
+    return bits & auxiliarySentBit;
+}
+
+void EspNowTransport::enableRelay(bool enable)
+{
+    relayEnabled = enable;
+    if (!enable)
+    {
+        // The units not answered yet retry with their next record
+        portENTER_CRITICAL(&transportLock);
+        relayInboxCount = 0;
+        portEXIT_CRITICAL(&transportLock);
+    }
+    WAKE_LOG("Relay role %d", enable)
+}
+
+bool EspNowTransport::waitRelayed(int timeoutMilliseconds)
+{
+    const bool received = xEventGroupWaitBits(espnowEventGroup, relayRecordBit, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeoutMilliseconds)) & relayRecordBit;
+    return received && answerRelayed();
+}
+
+int EspNowTransport::forwardRelayed()
+{
+    if (relayQueued == 0)
+    {
+        return 0;
+    }
+    // The records arriving meanwhile are answered and join the frame
+    const auto aggregationEnd = esp_timer_get_time() + relayAggregationMilliseconds * 1000;
+    for (auto left = aggregationEnd - esp_timer_get_time(); left > 0; left = aggregationEnd - esp_timer_get_time())
+    {
+        waitRelayed(static_cast<int>(left / 1000));
+    }
+    int forwarded = 0;
+    while (espNowPrepared)
+    {
+        std::array<MeasurementMessage, relayRecordsPerFrame> records;
+        const auto count = std::min(relayQueued, records.size());
+        std::copy_n(relayQueue.begin(), count, records.begin());
+        if (count == 0)
+        {
+            break;
+        }
+        std::array<uint8_t, maxRelayFrameSize> frame;
+        const auto size = packRelayFrame(frame.data(), records.data(), count);
+        bool sent = false;
+        for (int attempt = 0; attempt < relayForwardAttempts && !sent; ++attempt)
+        {
+            sent = sendAuxiliary(frame.data(), size);
+        }
+        if (!sent)
+        {
+            WAKE_LOG("Relay frame is not delivered, %u records kept", static_cast<unsigned>(relayQueued))
+            break;
+        }
+        std::move(relayQueue.begin() + count, relayQueue.begin() + relayQueued, relayQueue.begin());
+        relayQueued -= count;
+        forwarded += static_cast<int>(count);
+    }
+    if (forwarded > 0)
+    {
+        WAKE_LOG("Relayed %d records", forwarded)
+    }
+    return forwarded;
+}
+
+const OtaProtocol::ChunkMessage* EspNowTransport::getOtaChunk(uint32_t chunkIndex) const
+{
+    const auto slot = chunkIndex - otaFirstChunk;
+    if (slot >= OtaProtocol::chunksPerWake || !(otaReceivedMask & (1u << slot)))
+    {
+        return nullptr;
+    }
+    return &otaChunks[slot];
+}
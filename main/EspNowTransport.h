@@ -1,7 +1,17 @@
 #pragma once
 
+#include "AppConfig.h"
+#include "DiagnosticsMessage.h"
+#include "LinkAdaptation.h"
+#include "MeasurementMessage.h"
+#include "OtaMessages.h"
+#include "RelayMessage.h"
+#include "RouteSelector.h"
+#include "SessionKeys.h"
+
 #include "MemoryView.h"
 #include <cstdint>
+#include <optional>
 
 namespace embedded
 {
@@ -10,39 +20,82 @@ class PersistentStorage;
 
 class EspNowTransport {
 public:
-    struct Data
-    {
-        float humidity {};
-        float temperature {};
-        float pressure {};
-        int16_t pm01 {};
-        int16_t pm25 {};
-        int16_t pm10 {};
-        float batteryVoltage {};
-        uint32_t flags {};
-    };
-    enum class SendStatus {Idle, Requested, Failed, Awaiting, Completed};
+    using Data = MeasurementData;
+    enum class SendStatus {Idle, Scheduled, Requested, Failed, Awaiting, Completed};
 
     EspNowTransport(embedded::PersistentStorage &storage, bool restrictTxPower)
-    : storage(storage), restrictTxPower(restrictTxPower) {}
+    : storage(storage), link(storage, restrictTxPower ? restrictedTxPower : fullTxPower, AppConfig::allowLongRange)
+    , keys(storage) {}
     bool setup(embedded::CharView serial, bool wakeUp);
-    bool sendData(const Data& transportData);
+    // Waits for the delivery and the time correction no longer than the timeout
+    bool sendData(const Data& transportData, int timeoutMilliseconds);
+    // Brings up Wi-Fi and ESP-NOW, done by sendData() if not called before
+    bool prepare();
     SendStatus getStatus() const;
     int64_t getCorrection() const;
     bool hibernate();
-    void threadFunction();
+
+    // Entry points of the timer and ESP-NOW callbacks driving the send state machine
+    void onTimer();
+    void onSendResult(bool delivered);
+    void onCorrection(int64_t correction);
 
     int64_t getLastPacketTimestamp() const;
+    // Sequence number of the record being sent
+    uint32_t getSequence() const { return stats.sequence; }
+
+    std::optional<OtaProtocol::OfferMessage> getOtaOffer() const;
+    uint8_t requestOtaChunks(uint32_t sessionId, uint32_t firstChunk, uint8_t chunkCount, OtaProtocol::SessionStatus status);
+    const OtaProtocol::ChunkMessage* getOtaChunk(uint32_t chunkIndex) const;
+
+    // Sends the report without waiting for an answer, returns true when the delivery is acknowledged
+    bool sendDiagnostics(const DiagnosticsMessage& message);
+    // Sends an encoded BatchCodec frame the same way
+    bool sendBatch(const uint8_t* frame, size_t size);
+
+    // Relay role: the measurement messages of the units in AppConfig::relayedUnits are answered with the time
+    // correction and queued
+    void enableRelay(bool enable);
+    // Waits no longer than the timeout and answers the received records, returns true when new records are queued
+    bool waitRelayed(int timeoutMilliseconds);
+    // Forwards the queued records to the indoor unit, returns their number
+    int forwardRelayed();
 private:
-    bool prepareEspNow();
-    bool sendData();
+    bool sendAuxiliary(const uint8_t* frame, size_t size);
+    // Key handshake with the indoor unit, switches its peer entry to the encrypted one
+    bool establishKeys();
+    bool transmit();
+    void applyLinkProfile();
+    struct DeliveryStats
+    {
+        uint32_t sequence = 0;
+        // Last number of the block reserved in the flash
+        uint32_t sequenceLimit = 0;
+        uint32_t attempts = 0;
+        uint32_t failures = 0;
+        uint32_t dropped = 0;
+    };
+
     embedded::PersistentStorage &storage;
     Data data;
+    int64_t sampleTimestamp = 0;
+    DeliveryStats stats;
     volatile SendStatus sendStatus = EspNowTransport::SendStatus::Idle;
     mutable bool espNowPrepared = false;
-    bool restrictTxPower;
+    LinkAdaptation link;
+    RouteSelector router {1};
+    SessionKeys keys;
+    uint8_t route = RouteSelector::directRoute;
+    int routeAttempts = 0;
     embedded::CharView sps30Serial;
     volatile int64_t rtcCorrection = 0;
     int attemptsCounter = 0;
     static constexpr int maxAttempts = 10;
+    // The attempt switching to the robust link profile if the adapted one keeps failing
+    static constexpr int fallbackAttempt = 3;
+    // The attempt switching to the next best route, relay or direct
+    static constexpr int routeFallbackAttempt = 5;
+    // 8.5 dBm - workaround for Wemos C3Mini v1.0
+    static constexpr int8_t restrictedTxPower = 34;
+    static constexpr int8_t fullTxPower = 84;
 };
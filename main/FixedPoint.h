@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+// Fixed-point representation of the measured values, from the sensor registers to the wire format.
+// The ESP32-C3 has no FPU, so the wake path keeps every channel as an integer count of a fraction of its unit.
+// The scales are the counts per unit, known at compile time, so the conversions are integer multiplications and
+// divisions by constants.
+namespace FixedPoint
+{
+
+// 0.01 %
+constexpr int32_t humidityScale = 100;
+// 0.01 °C
+constexpr int32_t temperatureScale = 100;
+// 0.1 Pa
+constexpr int32_t pressureScale = 10;
+// mV
+constexpr int32_t voltageScale = 1000;
+
+// Value with From counts per unit in To counts per unit, rounded to the nearest
+template<int64_t From, int64_t To>
+constexpr int32_t rescale(int64_t value)
+{
+    if constexpr (From == To)
+    {
+        return static_cast<int32_t>(value);
+    }
+    const auto scaled = value * To;
+    return static_cast<int32_t>(scaled >= 0 ? (scaled + From / 2) / From : (scaled - From / 2) / From);
+}
+
+// The BME280 compensation results: temperature in 0.01 °C, pressure in Pa Q24.8, humidity in % Q22.10
+constexpr int32_t fromBme280Temperature(int32_t temperature)
+{
+    return rescale<100, temperatureScale>(temperature);
+}
+
+constexpr int32_t fromBme280Pressure(uint32_t pressure)
+{
+    return rescale<256, pressureScale>(pressure);
+}
+
+constexpr int32_t fromBme280Humidity(uint32_t humidity)
+{
+    return rescale<1024, humidityScale>(humidity);
+}
+
+// Fraction bits of the battery ADC conversion factor
+constexpr int fractionBits = 16;
+
+// The factor is mV per ADC count in Q16, derived from the configured divider when the unit is powered on
+constexpr int32_t millivoltsFromRaw(int voltageRaw, uint32_t millivoltsPerCount)
+{
+    return static_cast<int32_t>((uint64_t(voltageRaw) * millivoltsPerCount + (1u << (fractionBits - 1))) >> fractionBits);
+}
+
+// Integer part of an IEEE 754 single precision value given by its bits, saturated to the uint16_t range.
+// The SPS30 firmware 1.x only reports the mass concentrations as floats.
+constexpr uint16_t uint16FromFloatBits(uint32_t bits)
+{
+    constexpr int mantissaBits = 23;
+    constexpr int exponentBias = 127;
+    if (bits & 0x80000000u)
+    {
+        return 0;
+    }
+    const int exponent = static_cast<int>((bits >> mantissaBits) & 0xff) - exponentBias;
+    if (exponent < 0)
+    {
+        return 0;
+    }
+    if (exponent >= 16)
+    {
+        return UINT16_MAX;
+    }
+    const auto mantissa = (bits & ((1u << mantissaBits) - 1)) | (1u << mantissaBits);
+    return static_cast<uint16_t>(mantissa >> (mantissaBits - exponent));
+}
+
+}
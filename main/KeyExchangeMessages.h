@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Session key handshake carried unencrypted next to the measurement exchange.
+// The external unit sends a KeyRequestMessage with a fresh nonce; the indoor unit answers with the current key
+// epoch in an EpochAnnounceMessage. The announce tag is HMAC-SHA256 with the pre-shared key over the magic,
+// epoch, nonce and the MAC address of the requesting unit, truncated to 16 bytes, so an announce can't be forged
+// or replayed to another request. Both sides derive the ESP-NOW keys from the pre-shared key and the epoch.
+// The sizes never equal the sizes of the other messages.
+namespace KeyExchange
+{
+
+constexpr uint32_t requestMagic = 0x51524b53; // "SKRQ"
+constexpr uint32_t announceMagic = 0x4e414b53; // "SKAN"
+constexpr size_t tagSize = 16;
+
+struct __attribute__((packed)) KeyRequestMessage
+{
+    uint32_t magic;
+    uint32_t nonce;
+};
+
+struct __attribute__((packed)) EpochAnnounceMessage
+{
+    uint32_t magic;
+    uint32_t epoch;
+    uint32_t nonce;
+    std::array<uint8_t, tagSize> tag;
+};
+
+}
@@ -0,0 +1,152 @@
+#include "LinkAdaptation.h"
+
+#include "PersistentLayout.h"
+
+#include "PersistentStorage.h"
+
+#include <algorithm>
+#include <array>
+
+#include "BinaryLog.h"
+
+namespace
+{
+constexpr std::string_view linkDataTag = "LINK";
+constexpr int8_t unknownRssi = 0;
+constexpr uint8_t minStreak = 4;
+constexpr uint8_t maxStreak = 64;
+// More attempts than this count as a degraded link even if the packet was delivered
+constexpr int acceptableAttempts = 2;
+
+// A 150 bytes frame takes about 1.4 ms at 1 Mbps and under 0.1 ms at 24 Mbps, while the TX current
+// grows by roughly a third from 11 to 20 dBm, so the faster rates are cheaper per packet as long as
+// the first attempt succeeds. The RSSI thresholds include the margin lost by the lowered TX power.
+constexpr std::array<LinkAdaptation::Profile, 8> levels {{
+        { WIFI_PHY_RATE_24M, 44, -62 },
+        { WIFI_PHY_RATE_12M, 52, -70 },
+        { WIFI_PHY_RATE_6M, 60, -76 },
+        { WIFI_PHY_RATE_2M_L, 68, -82 },
+        { WIFI_PHY_RATE_1M_L, 76, -86 },
+        { WIFI_PHY_RATE_1M_L, 84, -128 },
+        { WIFI_PHY_RATE_LR_500K, 84, -128 },
+        { WIFI_PHY_RATE_LR_250K, 84, -128 },
+}};
+constexpr uint8_t robustLevel = 5;
+} // namespace
+
+void LinkAdaptation::setup(bool wakeUp)
+{
+    if (wakeUp)
+    {
+        if (auto data = storage.get<State>(linkDataTag))
+        {
+            state = *data;
+            return;
+        }
+    }
+    state = State { .level = distinct(robustLevel), .successStreak = 0, .requiredStreak = minStreak, .rssi = unknownRssi
+                    , .probing = false };
+}
+
+bool LinkAdaptation::isDuplicate(uint8_t level) const
+{
+    return level > 0 && level < levels.size() && levels[level].rate == levels[level - 1].rate
+           && std::min(levels[level].txPower, maxTxPower) == std::min(levels[level - 1].txPower, maxTxPower);
+}
+
+uint8_t LinkAdaptation::distinct(uint8_t level) const
+{
+    while (isDuplicate(level))
+    {
+        --level;
+    }
+    return level;
+}
+
+uint8_t LinkAdaptation::robuster(uint8_t level, int steps, uint8_t lastLevel) const
+{
+    for (; steps > 0; --steps)
+    {
+        auto next = static_cast<uint8_t>(level + 1);
+        while (next <= lastLevel && isDuplicate(next))
+        {
+            ++next;
+        }
+        if (next > lastLevel)
+        {
+            break;
+        }
+        level = next;
+    }
+    return level;
+}
+
+LinkAdaptation::Profile LinkAdaptation::getProfile() const
+{
+    auto profile = levels[std::min<size_t>(state.level, levels.size() - 1)];
+    profile.txPower = std::min(profile.txPower, maxTxPower);
+    return profile;
+}
+
+void LinkAdaptation::onRssi(int8_t rssi)
+{
+    state.rssi = state.rssi == unknownRssi ? rssi : static_cast<int8_t>((3 * state.rssi + rssi) / 4);
+}
+
+void LinkAdaptation::onExchange(bool delivered, int attempts)
+{
+    const bool probed = state.probing;
+    state.probing = false;
+    const uint8_t lastLevel = allowLongRange ? levels.size() - 1 : robustLevel;
+    if (!delivered || attempts > acceptableAttempts)
+    {
+        state.level = robuster(state.level, delivered ? 1 : 2, lastLevel);
+        state.successStreak = 0;
+        state.requiredStreak = std::min<uint8_t>(state.requiredStreak * 2, maxStreak);
+        WAKE_LOG("Link degraded, level %d, next probe after %d", state.level, state.requiredStreak)
+        return;
+    }
+    if (probed && attempts == 1)
+    {
+        // The cheaper level holds, one bad period doesn't slow the probes for good
+        state.requiredStreak = std::max<uint8_t>(state.requiredStreak / 2, minStreak);
+    }
+    if (state.rssi != unknownRssi && state.rssi < levels[state.level].minRssi)
+    {
+        // The margin is gone before any loss
+        state.level = robuster(state.level, 1, lastLevel);
+        state.successStreak = 0;
+        return;
+    }
+    if (attempts > 1 || state.level == 0)
+    {
+        return;
+    }
+    const bool rssiAllows = state.rssi == unknownRssi || state.rssi >= levels[distinct(state.level - 1)].minRssi;
+    state.successStreak = std::min<uint8_t>(state.successStreak + 1, maxStreak);
+    if (state.successStreak >= state.requiredStreak && rssiAllows)
+    {
+        state.level = distinct(state.level - 1);
+        state.successStreak = 0;
+        state.probing = true;
+        WAKE_LOG("Link probing level %d, RSSI %d", state.level, state.rssi)
+    }
+}
+
+bool LinkAdaptation::fallBack()
+{
+    if (state.level >= distinct(robustLevel))
+    {
+        return false;
+    }
+    state.level = distinct(robustLevel);
+    state.successStreak = 0;
+    state.requiredStreak = std::min<uint8_t>(state.requiredStreak * 2, maxStreak);
+    return true;
+}
+
+bool LinkAdaptation::hibernate()
+{
+    static_assert(sizeof(State) <= PersistentLayout::budgetOf(linkDataTag), "Link record exceeds its budget");
+    return PersistentLayout::store(storage, linkDataTag, state);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <esp_wifi_types.h>
+#include <cstdint>
+
+namespace embedded
+{
+class PersistentStorage;
+}
+
+// Chooses the ESP-NOW PHY rate and TX power for the next exchanges.
+// The levels are ordered from the cheapest (short airtime, low power) to the most robust one. A cheaper level
+// is tried after a streak of first-attempt deliveries when the RSSI of the replies leaves enough margin;
+// a retried or lost exchange moves back towards the robust end and makes the next probe wait longer, a probed
+// level that holds halves the wait again. A level the TX power cap makes equal to its neighbour is skipped.
+// The long range levels are used only when enabled in AppConfig, as the indoor unit has to accept LR frames.
+class LinkAdaptation
+{
+public:
+    struct Profile
+    {
+        wifi_phy_rate_t rate;
+        // In 0.25 dBm units, as esp_wifi_set_max_tx_power() takes it
+        int8_t txPower;
+        // The reply RSSI needed to use the level, dBm
+        int8_t minRssi;
+    };
+
+    LinkAdaptation(embedded::PersistentStorage& storage, int8_t maxTxPower, bool allowLongRange)
+    : storage(storage), maxTxPower(maxTxPower), allowLongRange(allowLongRange) {}
+
+    void setup(bool wakeUp);
+    Profile getProfile() const;
+    // Folds in the RSSI of a reply from the indoor unit
+    void onRssi(int8_t rssi);
+    // Accounts the result of a measurement exchange
+    void onExchange(bool delivered, int attempts);
+    // Switches to the robust level for the rest of the exchange; returns true if the level changed
+    bool fallBack();
+    bool hibernate();
+
+private:
+    // The same rate and capped TX power as the cheaper level before it
+    bool isDuplicate(uint8_t level) const;
+    // The cheapest of the levels equal to this one
+    uint8_t distinct(uint8_t level) const;
+    // Moves the steps towards the robust end over the duplicates, no further than the last level
+    uint8_t robuster(uint8_t level, int steps, uint8_t lastLevel) const;
+
+    struct State
+    {
+        uint8_t level = 0;
+        uint8_t successStreak = 0;
+        uint8_t requiredStreak = 0;
+        int8_t rssi = 0;
+        // The level was just made cheaper, the next exchange tells if it holds
+        bool probing = false;
+    } state;
+    embedded::PersistentStorage& storage;
+    int8_t maxTxPower;
+    bool allowLongRange;
+};
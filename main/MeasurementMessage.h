@@ -0,0 +1,84 @@
+#pragma once
+
+#include "FixedPoint.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// The PTH channels and the battery voltage in the counts of FixedPoint.h
+struct MeasurementData
+{
+    int32_t humidity {};
+    int32_t temperature {};
+    int32_t pressure {};
+    int16_t pm01 {};
+    int16_t pm25 {};
+    int16_t pm10 {};
+    int32_t batteryVoltage {};
+    uint32_t flags {};
+};
+
+// Set by packMeasurement when the message carries the fixed-point values
+constexpr uint32_t fixedPointFlag = 1u << 31;
+
+// Float in %, °C, Pa and V for the indoor units reading the original format, or the counts of FixedPoint.h
+union MeasurementValue
+{
+    float real;
+    int32_t fixed;
+};
+
+// Wire format of the measurement message sent to the indoor unit
+struct MeasurementMessage
+{
+    char spsSerial[32];
+    int16_t pm01;
+    int16_t pm25;
+    int16_t pm10;
+    MeasurementValue humidity;
+    MeasurementValue temperature;
+    MeasurementValue pressure;
+    MeasurementValue voltage;
+    // Send time of this attempt, used for the time correction
+    int64_t timestamp;
+    uint32_t flags;
+    // Per-device record number, the same in all the attempts, so the receiver can drop the duplicates
+    uint32_t sequence;
+    // Time the record was taken, the same in all the attempts
+    int64_t sampleTimestamp;
+    // Cumulative since the power on: transmissions, transmissions not acknowledged, records never acknowledged
+    uint32_t attempts;
+    uint32_t failures;
+    uint32_t dropped;
+};
+
+union MeasurementPacket
+{
+    MeasurementMessage message;
+    std::array<uint8_t, sizeof(MeasurementMessage)> bytes;
+};
+
+inline void packMeasurement(MeasurementPacket& packet, const MeasurementData& data, std::string_view spsSerial, bool fixedPoint)
+{
+    memcpy(packet.message.spsSerial, spsSerial.data(), std::min(sizeof(packet.message.spsSerial), spsSerial.size()));
+    packet.message.pm01 = data.pm01;
+    packet.message.pm25 = data.pm25;
+    packet.message.pm10 = data.pm10;
+    if (fixedPoint)
+    {
+        packet.message.pressure.fixed = data.pressure;
+        packet.message.humidity.fixed = data.humidity;
+        packet.message.temperature.fixed = data.temperature;
+        packet.message.voltage.fixed = data.batteryVoltage;
+        packet.message.flags = data.flags | fixedPointFlag;
+        return;
+    }
+    packet.message.pressure.real = static_cast<float>(data.pressure) / FixedPoint::pressureScale;
+    packet.message.humidity.real = static_cast<float>(data.humidity) / FixedPoint::humidityScale;
+    packet.message.temperature.real = static_cast<float>(data.temperature) / FixedPoint::temperatureScale;
+    packet.message.voltage.real = static_cast<float>(data.batteryVoltage) / FixedPoint::voltageScale;
+    packet.message.flags = data.flags;
+}
@@ -0,0 +1,100 @@
+#include "MemoryMonitor.h"
+
+#include "PersistentLayout.h"
+
+#include "PersistentStorage.h"
+
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <algorithm>
+
+#include "BinaryLog.h"
+
+namespace
+{
+constexpr std::string_view memoryDataTag = "MEMW";
+constexpr time_t reportInterval = 60 * 60; //seconds
+
+// Task names as created by ESP-IDF and Sps30CommandPipeline; the main task is sampled from itself
+constexpr std::array<const char*, static_cast<size_t>(MemoryMonitor::Task::Count)> taskNames = {
+        nullptr, "esp_timer", "wifi", "sps30"
+};
+
+uint16_t saturate(uint32_t value)
+{
+    return static_cast<uint16_t>(std::min<uint32_t>(value, UINT16_MAX));
+}
+} // namespace
+
+void MemoryMonitor::setup(bool wakeUp)
+{
+    if (wakeUp)
+    {
+        if (auto data = storage.get<WorstCase>(memoryDataTag))
+        {
+            worstCase = *data;
+        }
+    }
+}
+
+void MemoryMonitor::sample()
+{
+    const auto minFreeHeap = static_cast<uint32_t>(heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    worstCase.minFreeHeap = std::min(worstCase.minFreeHeap, minFreeHeap);
+    for (size_t i = 0; i < taskNames.size(); ++i)
+    {
+        TaskHandle_t task = taskNames[i] == nullptr ? nullptr : xTaskGetHandle(taskNames[i]);
+        if (taskNames[i] != nullptr && task == nullptr)
+        {
+            // The task is not started during this wake
+            continue;
+        }
+        // ESP-IDF reports the high-water mark in bytes
+        const auto stackFree = saturate(uxTaskGetStackHighWaterMark(task));
+        worstCase.minStackFree[i] = std::min(worstCase.minStackFree[i], stackFree);
+    }
+    WAKE_LOG("Memory: heap min %u, stack free main %u, timer %u, wifi %u, sps30 %u", static_cast<unsigned>(minFreeHeap)
+             , worstCase.minStackFree[0], worstCase.minStackFree[1], worstCase.minStackFree[2], worstCase.minStackFree[3])
+    WAKE_LOG("Persistent storage: %u of %u bytes used", static_cast<unsigned>(PersistentLayout::usedSize())
+             , static_cast<unsigned>(PersistentLayout::storageSize))
+}
+
+bool MemoryMonitor::isReportDue(time_t now) const
+{
+    return now - worstCase.lastReport >= reportInterval;
+}
+
+DiagnosticsMessage MemoryMonitor::makeReport() const
+{
+    DiagnosticsMessage report {
+            .magic = diagnosticsMagic,
+            .minFreeHeap = worstCase.minFreeHeap,
+            .mainStackFree = worstCase.minStackFree[static_cast<size_t>(Task::Main)],
+            .timerStackFree = worstCase.minStackFree[static_cast<size_t>(Task::Timer)],
+            .wifiStackFree = worstCase.minStackFree[static_cast<size_t>(Task::WiFi)],
+            .sps30StackFree = worstCase.minStackFree[static_cast<size_t>(Task::Sps30)],
+            .persistentUsed = static_cast<uint16_t>(PersistentLayout::usedSize()),
+            .persistentCapacity = static_cast<uint16_t>(PersistentLayout::storageSize),
+            .persistentRecords = {},
+            .phaseOverruns = {},
+            .abortedWakes = 0,
+    };
+    static_assert(sizeof(report.persistentRecords) == PersistentLayout::budgets.size(), "Record sizes mismatch");
+    for (size_t i = 0; i < PersistentLayout::budgets.size(); ++i)
+    {
+        report.persistentRecords[i] = static_cast<uint8_t>(PersistentLayout::storedSize(i));
+    }
+    return report;
+}
+
+void MemoryMonitor::reportSent(time_t now)
+{
+    worstCase.lastReport = now;
+}
+
+bool MemoryMonitor::hibernate()
+{
+    static_assert(sizeof(WorstCase) <= PersistentLayout::budgetOf(memoryDataTag), "Memory record exceeds its budget");
+    return PersistentLayout::store(storage, memoryDataTag, worstCase);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "DiagnosticsMessage.h"
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+
+namespace embedded
+{
+class PersistentStorage;
+}
+
+// Tracks the heap minimum and the stack high-water marks of the tasks active during the wake.
+// The worst cases over all wakes are kept in RTC memory and reported hourly in a DiagnosticsMessage.
+class MemoryMonitor
+{
+public:
+    enum class Task : uint8_t
+    {
+        Main,
+        Timer,
+        WiFi,
+        Sps30,
+        Count
+    };
+
+    explicit MemoryMonitor(embedded::PersistentStorage& storage) : storage(storage) {}
+
+    void setup(bool wakeUp);
+    // Folds the current heap minimum and stack high-water marks into the worst cases
+    void sample();
+    bool isReportDue(time_t now) const;
+    DiagnosticsMessage makeReport() const;
+    void reportSent(time_t now);
+    bool hibernate();
+
+private:
+    struct WorstCase
+    {
+        uint32_t minFreeHeap = UINT32_MAX;
+        std::array<uint16_t, static_cast<size_t>(Task::Count)> minStackFree { UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX };
+        time_t lastReport = 0;
+    } worstCase;
+    embedded::PersistentStorage& storage;
+};
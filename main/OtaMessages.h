@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Over-the-air update protocol carried by ESP-NOW next to the measurement exchange.
+// The indoor unit answers a measurement message with an optional OtaOfferMessage followed by the usual
+// correction message. While a session is active the external unit sends one OtaRequestMessage per wake
+// and the indoor unit replies with up to chunkCount OtaChunkMessage packets.
+// Session identifiers are never 0. All messages are fixed size and never equal to sizeof(CorrectionMessage),
+// so they can't be confused with it. The offer carries an HMAC-SHA256 tag with the pre-shared key over "OTA" and
+// all its fields before the tag, truncated to 16 bytes; the chunks are covered by the target digest it carries.
+namespace OtaProtocol
+{
+
+constexpr uint32_t offerMagic = 0x4f41544f; // "OTAO"
+constexpr uint32_t requestMagic = 0x5241544f; // "OTAR"
+constexpr uint32_t chunkMagic = 0x4341544f; // "OTAC"
+constexpr uint16_t maxChunkPayload = 200;
+constexpr uint8_t chunksPerWake = 4;
+constexpr size_t offerTagSize = 16;
+
+enum class SessionStatus : uint8_t
+{
+    Receiving,
+    Applied,
+    BaseMismatch,
+    Failed,
+};
+
+struct __attribute__((packed)) OfferMessage
+{
+    uint32_t magic;
+    uint32_t sessionId;
+    uint32_t deltaSize;
+    uint32_t imageSize;
+    uint16_t chunkSize;
+    // SHA-256 digests appended by esptool to the base and target images
+    std::array<uint8_t, 32> baseDigest;
+    std::array<uint8_t, 32> targetDigest;
+    std::array<uint8_t, offerTagSize> tag;
+};
+
+struct __attribute__((packed)) RequestMessage
+{
+    uint32_t magic;
+    uint32_t sessionId;
+    uint32_t firstChunk;
+    uint8_t chunkCount;
+    SessionStatus status;
+};
+
+struct __attribute__((packed)) ChunkMessage
+{
+    uint32_t magic;
+    uint32_t sessionId;
+    uint32_t chunkIndex;
+    uint16_t length;
+    std::array<uint8_t, maxChunkPayload> payload;
+};
+
+static_assert(sizeof(ChunkMessage) <= 250, "ESP-NOW payload limit exceeded");
+
+}
@@ -0,0 +1,410 @@
+#include "OtaUpdater.h"
+
+#include "EspNowTransport.h"
+#include "PersistentLayout.h"
+#include "PowerProfile.h"
+#include "SessionKeys.h"
+#include "Sha256.h"
+
+#include "PersistentStorage.h"
+
+#include <esp_ota_ops.h>
+#include <algorithm>
+#include <cstring>
+
+#include "BinaryLog.h"
+#include "Debug.h"
+
+namespace
+{
+constexpr std::string_view otaDataTag = "OTAU";
+// Flash bytes written per wake. Keeps each wake well below a second even when whole sectors are erased.
+constexpr size_t flashBudgetPerWake = 16 * 1024;
+constexpr size_t sectorSize = 4096;
+constexpr size_t digestSize = 32;
+// Image bytes hashed per wake, tens of milliseconds with the flash reads at the lowest CPU clock
+constexpr uint32_t digestBytesPerWake = 64 * 1024;
+
+constexpr uint8_t copyRunningOpcode = 0x00;
+constexpr uint8_t insertOpcode = 0x01;
+constexpr uint8_t copyTargetOpcode = 0x02;
+
+std::array<uint8_t, 512> copyBuffer;
+
+} // namespace
+
+void OtaUpdater::setup(bool wakeUp)
+{
+    runningPartition = esp_ota_get_running_partition();
+    targetPartition = esp_ota_get_next_update_partition(nullptr);
+    esp_ota_img_states_t imageState;
+    pendingVerify = esp_ota_get_state_partition(runningPartition, &imageState) == ESP_OK
+                    && imageState == ESP_OTA_IMG_PENDING_VERIFY;
+    if (wakeUp)
+    {
+        if (auto data = storage.get<State>(otaDataTag))
+        {
+            state = *data;
+        }
+    }
+}
+
+void OtaUpdater::process(EspNowTransport& transport)
+{
+    if (const auto offer = transport.getOtaOffer(); offer && offer->sessionId != state.sessionId)
+    {
+        // The image is checked against the digest of the offer only, so the offer itself has to be authentic
+        if (SessionKeys::verifyOffer(*offer))
+        {
+            begin(*offer);
+        }
+        else
+        {
+            WAKE_LOG("OTA offer %u is not authentic or no key is configured, ignored", static_cast<unsigned>(offer->sessionId))
+        }
+    }
+    if (state.sessionId == 0)
+    {
+        return;
+    }
+    if (state.status != OtaProtocol::SessionStatus::Receiving)
+    {
+        if (transport.getOtaOffer())
+        {
+            // The sender is still offering a finished session, report the outcome to stop it
+            transport.requestOtaChunks(state.sessionId, state.nextChunk, 0, state.status);
+        }
+        return;
+    }
+
+    size_t budget = flashBudgetPerWake;
+    if (state.phase == Phase::Copy && !drainCopy(budget))
+    {
+        return;
+    }
+    const auto chunksTotal = (state.deltaSize + state.chunkSize - 1) / state.chunkSize;
+    if (state.nextChunk < chunksTotal)
+    {
+        const auto chunksRequested = static_cast<uint8_t>(std::min<uint32_t>(OtaProtocol::chunksPerWake, chunksTotal - state.nextChunk));
+        const auto firstChunk = state.nextChunk;
+        const auto chunksReceived = transport.requestOtaChunks(state.sessionId, firstChunk, chunksRequested, state.status);
+        for (uint32_t index = firstChunk; index < firstChunk + chunksReceived; ++index)
+        {
+            const auto* chunk = transport.getOtaChunk(index);
+            if (chunk == nullptr || chunk->length <= state.chunkConsumed)
+            {
+                fail("Malformed chunk");
+                return;
+            }
+            size_t consumed = 0;
+            const bool chunkDone = consume(chunk->payload.data() + state.chunkConsumed, chunk->length - state.chunkConsumed, consumed, budget);
+            state.deltaConsumed += consumed;
+            state.chunkConsumed += consumed;
+            if (state.status != OtaProtocol::SessionStatus::Receiving)
+            {
+                return;
+            }
+            if (!chunkDone)
+            {
+                // Flash budget is exhausted, the rest of this chunk is requested again on the next wake
+                break;
+            }
+            ++state.nextChunk;
+            state.chunkConsumed = 0;
+        }
+    }
+    if (state.deltaConsumed >= state.deltaSize && state.phase == Phase::Opcode)
+    {
+        finish();
+    }
+}
+
+void OtaUpdater::onExchangeCompleted()
+{
+    if (!pendingVerify)
+    {
+        return;
+    }
+    // Until then the image is on trial: the bootloader goes back to the previous one on the next boot,
+    // so an update that hangs or can't reach the indoor unit doesn't strand the sealed unit
+    if (const auto result = esp_ota_mark_app_valid_cancel_rollback(); result != ESP_OK)
+    {
+        DEBUG_LOG("Failed to confirm the updated image: " << esp_err_to_name(result))
+        return;
+    }
+    pendingVerify = false;
+    WAKE_LOG("Updated image confirmed")
+}
+
+bool OtaUpdater::hibernate()
+{
+    static_assert(sizeof(State) <= PersistentLayout::budgetOf(otaDataTag), "OTA record exceeds its budget");
+    return PersistentLayout::store(storage, otaDataTag, state);
+}
+
+void OtaUpdater::begin(const OtaProtocol::OfferMessage& offer)
+{
+    state = State {};
+    state.sessionId = offer.sessionId;
+    state.deltaSize = offer.deltaSize;
+    state.imageSize = offer.imageSize;
+    state.chunkSize = offer.chunkSize;
+    state.targetDigest = offer.targetDigest;
+    state.status = OtaProtocol::SessionStatus::Receiving;
+    DEBUG_LOG("OTA session " << offer.sessionId << " offered: delta " << offer.deltaSize << " bytes, image " << offer.imageSize << " bytes")
+
+    if (runningPartition == nullptr || targetPartition == nullptr)
+    {
+        fail("No OTA partitions");
+        return;
+    }
+    if (state.chunkSize == 0 || state.chunkSize > OtaProtocol::maxChunkPayload
+        || state.imageSize <= digestSize || state.imageSize > targetPartition->size)
+    {
+        fail("Invalid offer");
+        return;
+    }
+    std::array<uint8_t, digestSize> runningDigest {};
+    if (esp_partition_get_sha256(runningPartition, runningDigest.data()) != ESP_OK)
+    {
+        fail("Running image digest is unavailable");
+        return;
+    }
+    if (runningDigest == offer.targetDigest)
+    {
+        DEBUG_LOG("OTA target image is already running")
+        state.status = OtaProtocol::SessionStatus::Applied;
+    }
+    else if (runningDigest != offer.baseDigest)
+    {
+        DEBUG_LOG("OTA delta base doesn't match the running image")
+        state.status = OtaProtocol::SessionStatus::BaseMismatch;
+    }
+}
+
+bool OtaUpdater::readVarint(uint8_t byte)
+{
+    if (state.varintShift >= 32)
+    {
+        fail("Varint overflow");
+        return false;
+    }
+    state.varintValue |= static_cast<uint32_t>(byte & 0x7f) << state.varintShift;
+    state.varintShift += 7;
+    return (byte & 0x80) == 0;
+}
+
+bool OtaUpdater::consume(const uint8_t* data, size_t size, size_t& consumed, size_t& budget)
+{
+    consumed = 0;
+    while (consumed < size)
+    {
+        if (state.status != OtaProtocol::SessionStatus::Receiving)
+        {
+            return false;
+        }
+        if (state.phase == Phase::Copy)
+        {
+            if (!drainCopy(budget))
+            {
+                return false;
+            }
+            continue;
+        }
+        if (state.phase == Phase::InsertData)
+        {
+            const auto size2write = std::min({size - consumed, size_t(state.remaining), budget});
+            if (size2write == 0)
+            {
+                return false;
+            }
+            if (!writeImage(data + consumed, size2write))
+            {
+                return false;
+            }
+            consumed += size2write;
+            budget -= size2write;
+            state.remaining -= size2write;
+            if (state.remaining == 0)
+            {
+                state.phase = Phase::Opcode;
+            }
+            continue;
+        }
+
+        const auto byte = data[consumed++];
+        switch (state.phase)
+        {
+            case Phase::Opcode:
+                state.varintValue = 0;
+                state.varintShift = 0;
+                if (byte == copyRunningOpcode || byte == copyTargetOpcode)
+                {
+                    state.source = byte == copyRunningOpcode ? Source::RunningImage : Source::TargetImage;
+                    state.phase = Phase::SourceOffset;
+                }
+                else if (byte == insertOpcode)
+                {
+                    state.phase = Phase::InsertLength;
+                }
+                else
+                {
+                    fail("Unknown delta opcode");
+                }
+                break;
+            case Phase::SourceOffset:
+                if (readVarint(byte))
+                {
+                    state.sourceOffset = state.varintValue;
+                    state.varintValue = 0;
+                    state.varintShift = 0;
+                    state.phase = Phase::SourceLength;
+                }
+                break;
+            case Phase::SourceLength:
+                if (readVarint(byte))
+                {
+                    state.remaining = state.varintValue;
+                    const auto sourceLimit = state.source == Source::RunningImage ? runningPartition->size : state.writeOffset;
+                    if (state.sourceOffset > sourceLimit || state.remaining > sourceLimit - state.sourceOffset)
+                    {
+                        fail("Copy source is out of range");
+                        break;
+                    }
+                    state.phase = state.remaining > 0 ? Phase::Copy : Phase::Opcode;
+                }
+                break;
+            case Phase::InsertLength:
+                if (readVarint(byte))
+                {
+                    state.remaining = state.varintValue;
+                    state.phase = state.remaining > 0 ? Phase::InsertData : Phase::Opcode;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return state.status == OtaProtocol::SessionStatus::Receiving;
+}
+
+bool OtaUpdater::drainCopy(size_t& budget)
+{
+    const auto* source = state.source == Source::RunningImage ? runningPartition : targetPartition;
+    while (state.remaining > 0)
+    {
+        const auto size = std::min({size_t(state.remaining), budget, copyBuffer.size()});
+        if (size == 0)
+        {
+            return false;
+        }
+        if (esp_partition_read(source, state.sourceOffset, copyBuffer.data(), size) != ESP_OK)
+        {
+            fail("Flash read failed");
+            return false;
+        }
+        if (!writeImage(copyBuffer.data(), size))
+        {
+            return false;
+        }
+        state.sourceOffset += size;
+        state.remaining -= size;
+        budget -= size;
+    }
+    state.phase = Phase::Opcode;
+    return true;
+}
+
+bool OtaUpdater::writeImage(const uint8_t* data, size_t size)
+{
+    if (state.writeOffset + size > state.imageSize)
+    {
+        fail("Image size exceeded");
+        return false;
+    }
+    const auto writeEnd = state.writeOffset + size;
+    if (writeEnd > state.erasedUpTo)
+    {
+        const auto eraseEnd = (writeEnd + sectorSize - 1) / sectorSize * sectorSize;
+        if (esp_partition_erase_range(targetPartition, state.erasedUpTo, eraseEnd - state.erasedUpTo) != ESP_OK)
+        {
+            fail("Flash erase failed");
+            return false;
+        }
+        state.erasedUpTo = eraseEnd;
+    }
+    if (esp_partition_write(targetPartition, state.writeOffset, data, size) != ESP_OK)
+    {
+        fail("Flash write failed");
+        return false;
+    }
+    state.writeOffset = writeEnd;
+    return true;
+}
+
+void OtaUpdater::finish()
+{
+    if (state.writeOffset != state.imageSize)
+    {
+        fail("Image size mismatch");
+        return;
+    }
+    Sha256::Digest digest {};
+    if (!hashImage(digest))
+    {
+        return;
+    }
+    if (digest != state.targetDigest)
+    {
+        fail("Image digest mismatch");
+        return;
+    }
+    if (const auto result = esp_ota_set_boot_partition(targetPartition); result != ESP_OK)
+    {
+        DEBUG_LOG("Failed to switch boot partition: " << esp_err_to_name(result))
+        fail("Image validation failed");
+        return;
+    }
+    DEBUG_LOG("OTA session " << state.sessionId << " is applied, restart is required")
+    state.status = OtaProtocol::SessionStatus::Applied;
+    restartRequired = true;
+}
+
+bool OtaUpdater::hashImage(Sha256::Digest& digest)
+{
+    // The digest appended by esptool is not hashed
+    const auto hashedSize = state.imageSize - digestSize;
+    if (state.digestOffset == 0)
+    {
+        state.digestState = Sha256::initialState();
+    }
+    const auto sliceEnd = std::min(hashedSize, state.digestOffset + digestBytesPerWake);
+    // The software digest is the only CPU bound work of the wake
+    POWER_PROFILE(Compute)
+    while (state.digestOffset < sliceEnd)
+    {
+        // Whole buffers keep the offset block aligned until the last read
+        const auto size = std::min<uint32_t>(copyBuffer.size(), hashedSize - state.digestOffset);
+        if (esp_partition_read(targetPartition, state.digestOffset, copyBuffer.data(), size) != ESP_OK)
+        {
+            fail("Flash read failed");
+            return false;
+        }
+        const auto blocksSize = size / Sha256::blockSize * Sha256::blockSize;
+        Sha256::update(state.digestState, copyBuffer.data(), blocksSize);
+        state.digestOffset += size;
+        if (state.digestOffset == hashedSize)
+        {
+            digest = Sha256::finish(state.digestState, copyBuffer.data() + blocksSize, size - blocksSize, hashedSize);
+            return true;
+        }
+    }
+    WAKE_LOG("OTA image hashed up to %u", static_cast<unsigned>(state.digestOffset))
+    return false;
+}
+
+void OtaUpdater::fail(const char* reason)
+{
+    DEBUG_LOG("OTA session " << state.sessionId << " failed: " << reason)
+    state.status = OtaProtocol::SessionStatus::Failed;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "OtaMessages.h"
+#include "Sha256.h"
+
+#include <esp_partition.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace embedded
+{
+class PersistentStorage;
+}
+
+class EspNowTransport;
+
+// Applies a firmware delta received as ESP-NOW chunks over many wakes.
+// The delta is a stream of operations building the target image:
+//  0x00 <offset> <length>  - copy bytes from the running image
+//  0x01 <length> <bytes>   - insert literal bytes
+//  0x02 <offset> <length>  - copy bytes already written to the target image (LZ-style back reference)
+// All numbers are LEB128 varints. The decoder state is kept in RTC memory, so the transfer survives deep sleep.
+class OtaUpdater
+{
+public:
+    explicit OtaUpdater(embedded::PersistentStorage& storage) : storage(storage) {}
+
+    void setup(bool wakeUp);
+    void process(EspNowTransport& transport);
+    bool hibernate();
+    bool isRestartRequired() const { return restartRequired; }
+    // Confirms an updated image on its first acknowledged exchange with the indoor unit
+    void onExchangeCompleted();
+
+private:
+    enum class Phase : uint8_t
+    {
+        Opcode,
+        SourceOffset,
+        SourceLength,
+        InsertLength,
+        InsertData,
+        Copy,
+    };
+
+    enum class Source : uint8_t
+    {
+        RunningImage,
+        TargetImage,
+    };
+
+    struct State
+    {
+        uint32_t sessionId = 0;
+        uint32_t deltaSize = 0;
+        uint32_t imageSize = 0;
+        uint16_t chunkSize = 0;
+        OtaProtocol::SessionStatus status = OtaProtocol::SessionStatus::Failed;
+        std::array<uint8_t, 32> targetDigest {};
+        uint32_t nextChunk = 0;
+        uint16_t chunkConsumed = 0;
+        uint32_t deltaConsumed = 0;
+        uint32_t writeOffset = 0;
+        uint32_t erasedUpTo = 0;
+        Phase phase = Phase::Opcode;
+        Source source = Source::RunningImage;
+        uint8_t varintShift = 0;
+        uint32_t varintValue = 0;
+        uint32_t sourceOffset = 0;
+        uint32_t remaining = 0;
+        // The image digest is computed over several wakes once the image is written
+        uint32_t digestOffset = 0;
+        Sha256::State digestState {};
+    } state;
+
+    void begin(const OtaProtocol::OfferMessage& offer);
+    bool consume(const uint8_t* data, size_t size, size_t& consumed, size_t& budget);
+    bool drainCopy(size_t& budget);
+    bool readVarint(uint8_t byte);
+    bool writeImage(const uint8_t* data, size_t size);
+    // Continues the digest of the written image, true when it is complete
+    bool hashImage(Sha256::Digest& digest);
+    void finish();
+    void fail(const char* reason);
+
+    embedded::PersistentStorage& storage;
+    const esp_partition_t* runningPartition = nullptr;
+    const esp_partition_t* targetPartition = nullptr;
+    bool restartRequired = false;
+    bool pendingVerify = false;
+};
@@ -1,5 +1,6 @@
 #include "PTHProvider.h"
 
+#include "BinaryLog.h"
 #include "Debug.h"
 #include "Delays.h"
 
@@ -38,15 +39,22 @@ bool PTHProvider::setup(bool wakeUp)
             DEBUG_LOG("BME280 calibration data load failed, trying to initialize")
             return setup(false);
         }
-        DEBUG_LOG("BME280 calibration data loaded")
+        WAKE_LOG("BME280 calibration data loaded")
     }
     return true;
 }
 
-bool PTHProvider::doMeasure()
+bool PTHProvider::doMeasure(int timeoutMilliseconds, bool (*aborted)())
 {
+    const auto startMicroseconds = embedded::getMicrosecondTicks();
     while (bme.isMeasuring())
     {
+        if (embedded::getMicrosecondTicks() - startMicroseconds >= uint64_t(timeoutMilliseconds) * 1000
+            || (aborted != nullptr && aborted()))
+        {
+            WAKE_LOG("BME280 measurement timed out")
+            return false;
+        }
         embedded::delay(10);
     }
     if (auto fixedResult = bme.getMeasureData())
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "FixedPoint.h"
+
 #include "BME280/BME280.h"
 #include "BME280/I2CHelper.h"
 
@@ -10,19 +12,26 @@ public:
     bool setup(bool wakeUp);
     bool activate();
     bool hibernate();
-    bool doMeasure();
+    // Returns false if the measurement is not completed within the timeout or the aborted check turns true
+    bool doMeasure(int timeoutMilliseconds, bool (*aborted)() = nullptr);
 
-    float getPressure() const
+    // In the counts of FixedPoint.h
+    int32_t getPressure() const
+    {
+        return FixedPoint::fromBme280Pressure(measurementData.pressure);
+    }
+    int32_t getTemperature() const
     {
-        return static_cast<float>(measurementData.pressure) / 256.f;
+        return FixedPoint::fromBme280Temperature(measurementData.temperature);
     }
-    float getTemperature() const
+    int32_t getHumidity() const
     {
-        return static_cast<float>(measurementData.temperature) / 100.f;;
+        return FixedPoint::fromBme280Humidity(measurementData.humidity);
     }
-    float getHumidity() const
+    // The compensated values in the fixed-point units of the driver
+    const embedded::BMPE280::MeasurementData& getRawData() const
     {
-        return static_cast<float>(measurementData.humidity) / 1024.f;
+        return measurementData;
     }
 
 private:
@@ -0,0 +1,42 @@
+#include "PersistentLayout.h"
+
+#include <esp_attr.h>
+#include <algorithm>
+
+namespace
+{
+RTC_DATA_ATTR std::array<uint8_t, PersistentLayout::budgets.size()> storedSizes;
+} // namespace
+
+namespace PersistentLayout
+{
+
+size_t storedSize(size_t index)
+{
+    return index < storedSizes.size() ? storedSizes[index] : 0;
+}
+
+size_t usedSize()
+{
+    size_t size = 0;
+    for (const auto storedSize : storedSizes)
+    {
+        size += storedSize > 0 ? storedSize + recordOverhead : 0;
+    }
+    return size;
+}
+
+void clearStored()
+{
+    storedSizes.fill(0);
+}
+
+void noteStored(std::string_view tag, size_t size)
+{
+    if (const auto index = indexOf(tag); index < storedSizes.size())
+    {
+        storedSizes[index] = static_cast<uint8_t>(std::min<size_t>(size, UINT8_MAX));
+    }
+}
+
+}
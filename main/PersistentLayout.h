@@ -0,0 +1,95 @@
+#pragma once
+
+#include "PersistentStorage.h"
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+// RTC memory budget of embedded::PersistentStorage.
+// Every record kept in the storage has a budget here. The owners check their record type against it with
+// static_assert, so a record outgrowing its budget or a budget table outgrowing the storage breaks the build
+// instead of failing the storage at runtime. The records stored through store() are accounted, so the diagnostics
+// report what the storage actually holds.
+namespace PersistentLayout
+{
+
+constexpr size_t storageSize = 2048;
+// Reserve for the tag and size PersistentStorage keeps next to every record
+constexpr size_t recordOverhead = 8;
+
+struct Budget
+{
+    std::string_view tag;
+    size_t size;
+};
+
+constexpr std::array budgets {
+        Budget { "DMC", 96 },
+        Budget { "SPSD", 80 },
+        Budget { "PTHD", 64 },
+        Budget { "OTAU", 128 },
+        Budget { "MEMW", 32 },
+        Budget { "LINK", 16 },
+        Budget { "WDLN", 16 },
+        Budget { "ESPN", 24 },
+        Budget { "ROUT", 8 },
+        Budget { "KEYS", 32 },
+        Budget { "WSCH", 128 },
+};
+
+// Zero for the tags without a budget, so a new record can't pass the check unnoticed
+constexpr size_t budgetOf(std::string_view tag)
+{
+    for (const auto& budget : budgets)
+    {
+        if (budget.tag == tag)
+        {
+            return budget.size;
+        }
+    }
+    return 0;
+}
+
+constexpr size_t reservedSize()
+{
+    size_t size = 0;
+    for (const auto& budget : budgets)
+    {
+        size += budget.size + recordOverhead;
+    }
+    return size;
+}
+
+static_assert(reservedSize() <= storageSize, "Persistent record budgets exceed the RTC storage");
+
+// Position of the tag in the budget table, budgets.size() for an unknown tag
+constexpr size_t indexOf(std::string_view tag)
+{
+    for (size_t i = 0; i < budgets.size(); ++i)
+    {
+        if (budgets[i].tag == tag)
+        {
+            return i;
+        }
+    }
+    return budgets.size();
+}
+
+// Size of the record last stored under the tag since the power on, 0 if it is not stored
+size_t storedSize(size_t index);
+// Bytes taken by the stored records with their overhead
+size_t usedSize();
+void noteStored(std::string_view tag, size_t size);
+// The storage is initialized empty
+void clearStored();
+
+template<typename T>
+bool store(embedded::PersistentStorage& storage, std::string_view tag, const T& record)
+{
+    const bool stored = storage.set(tag, record);
+    noteStored(tag, stored ? sizeof(T) : 0);
+    return stored;
+}
+
+}
@@ -0,0 +1,141 @@
+#include "PowerProfile.h"
+
+#include <esp_idf_version.h>
+#include <esp_pm.h>
+#include <sdkconfig.h>
+
+#include "BinaryLog.h"
+
+#ifdef CONFIG_PM_ENABLE
+namespace
+{
+// The default CPU frequency of the configuration stays at 80 MHz, only the Compute locks go above it
+#if defined(CONFIG_IDF_TARGET_ESP32C3)
+constexpr int maxFrequencyMhz = 160;
+#else
+constexpr int maxFrequencyMhz = 240;
+#endif
+constexpr int minFrequencyMhz = 40;
+
+esp_pm_lock_handle_t cpuLock = nullptr;
+esp_pm_lock_handle_t apbLock = nullptr;
+esp_pm_lock_handle_t noSleepLock = nullptr;
+esp_pm_lock_handle_t sps30ApbLock = nullptr;
+esp_pm_lock_handle_t sps30NoSleepLock = nullptr;
+PowerProfile::Mode currentMode = PowerProfile::Mode::Wait;
+bool sps30Held = false;
+
+void acquire(PowerProfile::Mode mode)
+{
+    switch (mode)
+    {
+        case PowerProfile::Mode::Compute:
+            esp_pm_lock_acquire(cpuLock);
+            esp_pm_lock_acquire(noSleepLock);
+            break;
+        case PowerProfile::Mode::Io:
+            esp_pm_lock_acquire(apbLock);
+            esp_pm_lock_acquire(noSleepLock);
+            break;
+        case PowerProfile::Mode::Wait:
+            break;
+    }
+}
+
+void release(PowerProfile::Mode mode)
+{
+    switch (mode)
+    {
+        case PowerProfile::Mode::Compute:
+            esp_pm_lock_release(cpuLock);
+            esp_pm_lock_release(noSleepLock);
+            break;
+        case PowerProfile::Mode::Io:
+            esp_pm_lock_release(apbLock);
+            esp_pm_lock_release(noSleepLock);
+            break;
+        case PowerProfile::Mode::Wait:
+            break;
+    }
+}
+} // namespace
+
+bool PowerProfile::setup()
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    esp_pm_config_t config {
+#elif defined(CONFIG_IDF_TARGET_ESP32C3)
+    esp_pm_config_esp32c3_t config {
+#else
+    esp_pm_config_esp32_t config {
+#endif
+            .max_freq_mhz = maxFrequencyMhz, .min_freq_mhz = minFrequencyMhz, .light_sleep_enable = true
+    };
+    const bool locksCreated = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "compute", &cpuLock) == ESP_OK
+            && esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "io", &apbLock) == ESP_OK
+            && esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "awake", &noSleepLock) == ESP_OK
+            && esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "sps30", &sps30ApbLock) == ESP_OK
+            && esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "sps30Awake", &sps30NoSleepLock) == ESP_OK;
+    if (!locksCreated)
+    {
+        return false;
+    }
+    // Locked before the configuration, so the startup keeps the default 80 MHz
+    switchTo(Mode::Io);
+    if (const auto result = esp_pm_configure(&config); result != ESP_OK)
+    {
+        WAKE_LOG("Power management configuration failed: 0x%x", result)
+        return false;
+    }
+    return true;
+}
+
+PowerProfile::Mode PowerProfile::switchTo(Mode mode)
+{
+    const auto previous = currentMode;
+    if (mode != previous && cpuLock != nullptr)
+    {
+        // Acquired first, so the frequency doesn't drop in between
+        acquire(mode);
+        release(previous);
+        currentMode = mode;
+    }
+    return previous;
+}
+
+void PowerProfile::holdSps30Io(bool hold)
+{
+    if (hold == sps30Held || sps30ApbLock == nullptr)
+    {
+        return;
+    }
+    sps30Held = hold;
+    if (hold)
+    {
+        esp_pm_lock_acquire(sps30ApbLock);
+        esp_pm_lock_acquire(sps30NoSleepLock);
+    }
+    else
+    {
+        esp_pm_lock_release(sps30ApbLock);
+        esp_pm_lock_release(sps30NoSleepLock);
+    }
+}
+
+#else
+
+bool PowerProfile::setup()
+{
+    return true;
+}
+
+PowerProfile::Mode PowerProfile::switchTo(Mode mode)
+{
+    return mode;
+}
+
+void PowerProfile::holdSps30Io(bool /*hold*/)
+{
+}
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+// Phase-scoped power management profiles on top of the ESP-IDF power management locks.
+// With nothing held the chip runs at the XTAL frequency and enters the automatic light sleep when idle;
+// a profile holds the locks its phase needs:
+//  Compute - the maximum CPU frequency, only around the CPU bound work like the OTA image digest
+//  Io      - APB at 80 MHz and no light sleep; the default mode of the wake outside the other profiles
+//            and while UART transfers or the ESP-NOW exchange are pending
+//  Wait    - nothing, for the waits on the sensors; the I2C driver takes the APB lock for its transactions itself
+// Requires CONFIG_PM_ENABLE, otherwise all the calls do nothing.
+class PowerProfile
+{
+public:
+    enum class Mode : uint8_t
+    {
+        Compute,
+        Io,
+        Wait,
+    };
+
+    class Scope
+    {
+    public:
+        explicit Scope(Mode mode) : previous(PowerProfile::switchTo(mode)) {}
+        ~Scope() { PowerProfile::switchTo(previous); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        Mode previous;
+    };
+
+    // Configures the dynamic frequency scaling and starts in the Io mode
+    static bool setup();
+    // Returns the previous mode
+    static Mode switchTo(Mode mode);
+    // Keeps the Io locks regardless of the mode, for the SPS30 commands running in background
+    static void holdSps30Io(bool hold);
+};
+
+#define POWER_PROFILE(mode) PowerProfile::Scope powerProfileScope(PowerProfile::Mode::mode);
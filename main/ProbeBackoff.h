@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Retry times of a sensor not found by the probe: the first retry 5 minutes after the failure, every next one
+// after twice the previous delay, at most 12 hours apart. Kept in the owner's persistent record, so the schedule
+// survives the deep sleep; the times are wall clock seconds.
+struct ProbeBackoff
+{
+    static constexpr uint32_t firstDelaySeconds = 5 * 60;
+    static constexpr uint32_t maxDelaySeconds = 12 * 3600;
+
+    // Time of the next probe, 0 when the probe may run right away
+    uint32_t nextProbe = 0;
+    // Consecutive failed probes
+    uint8_t failures = 0;
+
+    bool isDue(uint32_t now) const { return now >= nextProbe; }
+
+    void failed(uint32_t now)
+    {
+        const auto delay = failures < 16 ? std::min(firstDelaySeconds << failures, maxDelaySeconds) : maxDelaySeconds;
+        failures = static_cast<uint8_t>(std::min<int>(failures + 1, UINT8_MAX));
+        nextProbe = now + delay;
+    }
+
+    void succeeded() { *this = {}; }
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "MeasurementMessage.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Wire format of the records forwarded by a relay unit to the indoor unit.
+// The relay answers the time correction itself and forwards the measurement messages of the other units
+// unchanged, several in one frame; the indoor unit drops the duplicates by the serial and the sequence number.
+constexpr uint32_t relayMagic = 0x59414c52; // "RLAY"
+constexpr size_t maxRelayFrameSize = 250;
+
+struct RelayHeader
+{
+    uint32_t magic;
+    uint8_t count;
+    uint8_t reserved[3];
+};
+
+constexpr size_t relayRecordsPerFrame = (maxRelayFrameSize - sizeof(RelayHeader)) / sizeof(MeasurementMessage);
+static_assert(relayRecordsPerFrame >= 2, "Relay frame doesn't aggregate the records");
+
+// Returns the frame size, the count has to be up to relayRecordsPerFrame
+inline size_t packRelayFrame(uint8_t* frame, const MeasurementMessage* records, size_t count)
+{
+    const RelayHeader header { relayMagic, static_cast<uint8_t>(count), {} };
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), records, count * sizeof(MeasurementMessage));
+    return sizeof(header) + count * sizeof(MeasurementMessage);
+}
@@ -0,0 +1,75 @@
+#include "RouteSelector.h"
+
+#include <algorithm>
+
+namespace
+{
+// An unknown route is assumed to be as good as half of the exchanges delivered at the first attempt
+constexpr uint8_t initialScore = 128;
+// A route has to be better by this much to replace the current one
+constexpr uint8_t switchMargin = 24;
+// One of 64 exchanges, about an hour, goes through the best of the other routes
+constexpr uint8_t probeInterval = 64;
+} // namespace
+
+RouteSelector::RouteSelector(size_t routeCount)
+: routeCount(std::clamp<size_t>(routeCount, 1, maxRoutes))
+{
+    state.score.fill(initialScore);
+}
+
+void RouteSelector::restore(const State& restored)
+{
+    state = restored;
+    if (state.current >= routeCount)
+    {
+        state.current = directRoute;
+    }
+}
+
+uint8_t RouteSelector::select()
+{
+    if (routeCount > 1 && ++state.exchangesSinceProbe >= probeInterval)
+    {
+        state.exchangesSinceProbe = 0;
+        return alternative(state.current);
+    }
+    return state.current;
+}
+
+uint8_t RouteSelector::alternative(uint8_t failed) const
+{
+    uint8_t best = failed;
+    for (uint8_t route = 0; route < routeCount; ++route)
+    {
+        if (route != failed && (best == failed || state.score[route] > state.score[best]))
+        {
+            best = route;
+        }
+    }
+    return best;
+}
+
+void RouteSelector::onExchange(uint8_t route, bool delivered, int attempts)
+{
+    if (route >= routeCount)
+    {
+        return;
+    }
+    const int sample = delivered ? 255 / std::max(attempts, 1) : 0;
+    auto& score = state.score[route];
+    score = static_cast<uint8_t>((3 * score + sample) / 4);
+
+    uint8_t best = state.current;
+    for (uint8_t candidate = 0; candidate < routeCount; ++candidate)
+    {
+        if (state.score[candidate] > state.score[best])
+        {
+            best = candidate;
+        }
+    }
+    if (state.score[best] >= state.score[state.current] + switchMargin)
+    {
+        state.current = best;
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Chooses the peer the measurement exchange goes through: the indoor unit directly or one of the relays.
+// Every route keeps a delivery score, an average of 255 / attempts for the delivered exchanges and 0 for the lost
+// ones. The direct route is used first, as it has no forwarding delay, and another one replaces the current
+// route only when scored clearly better. A route failing in the middle of an exchange hands the remaining
+// attempts to the next best one, and from time to time a single exchange probes another route, so a recovered
+// direct link or a new relay are noticed.
+// Hardware independent, the owner keeps the state in the persistent storage.
+class RouteSelector
+{
+public:
+    static constexpr size_t maxRoutes = 3;
+    static constexpr uint8_t directRoute = 0;
+
+    struct State
+    {
+        std::array<uint8_t, maxRoutes> score {};
+        uint8_t current = directRoute;
+        uint8_t exchangesSinceProbe = 0;
+    };
+
+    explicit RouteSelector(size_t routeCount);
+
+    void restore(const State& restored);
+    const State& getState() const { return state; }
+    // Route for the next exchange
+    uint8_t select();
+    // Next best route after the given one, the same route if there is no other
+    uint8_t alternative(uint8_t failed) const;
+    // Accounts the result of the attempts made over the route
+    void onExchange(uint8_t route, bool delivered, int attempts);
+
+private:
+    State state;
+    size_t routeCount;
+};
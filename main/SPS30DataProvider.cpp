@@ -1,11 +1,56 @@
 #include "SPS30DataProvider.h"
 
+#include "PersistentLayout.h"
+
 #include "PersistentStorage.h"
+#include <nvs.h>
+#include <cstring>
+#include "BinaryLog.h"
 #include "Debug.h"
 
 namespace
 {
     constexpr std::string_view sps30DataKey = "SPSD";
+    // The identity is kept in the flash over the power cycles
+    constexpr const char* identityNamespace = "sps30";
+    constexpr const char* identityKey = "identity";
+
+    struct Identity
+    {
+        embedded::Sps30SerialNumber serialNumber {};
+        int16_t firmwareMajorVersion = 0;
+    };
+
+    bool loadIdentity(Identity& identity)
+    {
+        nvs_handle_t handle;
+        if (nvs_open(identityNamespace, NVS_READONLY, &handle) != ESP_OK)
+        {
+            return false;
+        }
+        size_t size = sizeof(identity);
+        const auto result = nvs_get_blob(handle, identityKey, &identity, &size);
+        nvs_close(handle);
+        return result == ESP_OK && size == sizeof(identity);
+    }
+
+    void storeIdentity(const Identity& identity)
+    {
+        nvs_handle_t handle;
+        if (nvs_open(identityNamespace, NVS_READWRITE, &handle) != ESP_OK)
+        {
+            return;
+        }
+        if (const auto result = nvs_set_blob(handle, identityKey, &identity, sizeof(identity)); result == ESP_OK)
+        {
+            nvs_commit(handle);
+        }
+        else
+        {
+            DEBUG_LOG("SPS30 identity is not stored: " << esp_err_to_name(result))
+        }
+        nvs_close(handle);
+    }
 }
 
 using embedded::Sps30Error;
@@ -17,95 +62,136 @@ bool SPS30DataProvider::setup(bool wakeUp)
         if (const auto storedData = storage.get<Data>(sps30DataKey); storedData)
         {
             data = *storedData;
-            DEBUG_LOG("Restored SPS30 data: " << (data.sensorPresent ? data.serialNumber.serial : "sensor not found"))
+            pipeline.useIntegerOutput(data.firmwareMajorVersion > 1);
+            WAKE_LOG("Restored SPS30 data, sensor present: %d", data.sensorPresent)
             return data.sensorPresent;
         }
         DEBUG_LOG("SPS30 data is not found")
     }
+    // The clock is not set yet, the first retry runs with the first synchronized wake
+    probe(0);
+    PersistentLayout::store(storage, sps30DataKey, data);
+    return data.sensorPresent;
+}
+
+bool SPS30DataProvider::probe(uint32_t now)
+{
+    data.sensorPresent = identify();
+    if (data.sensorPresent)
+    {
+        data.probeBackoff.succeeded();
+    }
+    else
+    {
+        data.probeBackoff.failed(now);
+        WAKE_LOG("SPS30 is not found, %u probes failed", static_cast<unsigned>(data.probeBackoff.failures))
+    }
+    pipeline.useIntegerOutput(data.firmwareMajorVersion > 1);
+    return data.sensorPresent;
+}
+
+bool SPS30DataProvider::identify()
+{
     DEBUG_LOG("Probing SPS30")
     auto spsInitResult = sps30.probe();
     if (spsInitResult == Sps30Error::Success)
     {
         spsInitResult = sps30.getSerial(data.serialNumber);
         DEBUG_LOG("Serial number: " << data.serialNumber.serial)
-        sps30.resetSensor();
-        auto versionResult = sps30.getVersion();
-        if (std::holds_alternative<embedded::Sps30VersionInformation>(versionResult))
-        {
-            const auto& sps30Version = std::get<embedded::Sps30VersionInformation>(versionResult);
-            DEBUG_LOG("Firmware revision: " << (int) sps30Version.firmware_major << "." << (int) sps30Version.firmware_minor)
-            data.firmwareMajorVersion = sps30Version.firmware_major;
-            if (sps30Version.shdlc)
-            {
-                DEBUG_LOG("Hardware revision: " << (int)sps30Version.shdlc->hardware_revision)
-                DEBUG_LOG("SHDLC revision: " << (int)sps30Version.shdlc->shdlc_major << "." << (int)sps30Version.shdlc->shdlc_minor)
-            }
-        } else
+    }
+    if (spsInitResult != Sps30Error::Success)
+    {
+        DEBUG_LOG("Probe is failed with code: " << (int)spsInitResult)
+        return false;
+    }
+    // The serial number tells whether the sensor is changed, the reset and the version reading are skipped otherwise
+    Identity identity;
+    if (loadIdentity(identity) && strncmp(identity.serialNumber.serial, data.serialNumber.serial
+                                          , sizeof(identity.serialNumber.serial)) == 0)
+    {
+        data.firmwareMajorVersion = identity.firmwareMajorVersion;
+        WAKE_LOG("SPS30 identity is restored, firmware %d", data.firmwareMajorVersion)
+        return true;
+    }
+    sps30.resetSensor();
+    auto versionResult = sps30.getVersion();
+    if (std::holds_alternative<embedded::Sps30VersionInformation>(versionResult))
+    {
+        const auto& sps30Version = std::get<embedded::Sps30VersionInformation>(versionResult);
+        DEBUG_LOG("Firmware revision: " << (int) sps30Version.firmware_major << "." << (int) sps30Version.firmware_minor)
+        data.firmwareMajorVersion = sps30Version.firmware_major;
+        if (sps30Version.shdlc)
         {
-            DEBUG_LOG("Firmware revision reading failed with code: " << (int) spsInitResult)
+            DEBUG_LOG("Hardware revision: " << (int)sps30Version.shdlc->hardware_revision)
+            DEBUG_LOG("SHDLC revision: " << (int)sps30Version.shdlc->shdlc_major << "." << (int)sps30Version.shdlc->shdlc_minor)
         }
+        identity.serialNumber = data.serialNumber;
+        identity.firmwareMajorVersion = data.firmwareMajorVersion;
+        storeIdentity(identity);
+    } else
+    {
+        DEBUG_LOG("Firmware revision reading failed with code: " << (int) spsInitResult)
     }
-    else
+    return true;
+}
+
+bool SPS30DataProvider::startMeasure(bool fanCleaning)
+{
+    if (!data.sensorPresent)
     {
-        DEBUG_LOG("Probe is failed with code: " << (int)spsInitResult)
+        return false;
     }
-    data.sensorPresent = spsInitResult == Sps30Error::Success;
-    storage.set(sps30DataKey, data);
-    return data.sensorPresent;
+    auto result = pipeline.submit(Sps30CommandPipeline::Command::StartMeasurement);
+    if (result && fanCleaning)
+    {
+        WAKE_LOG("Manual cleaning is requested")
+        pipeline.submit(Sps30CommandPipeline::Command::StartFanCleaning);
+    }
+    return result;
 }
 
-bool SPS30DataProvider::startMeasure()
+bool SPS30DataProvider::requestMeasureData()
 {
     if (!data.sensorPresent)
     {
         return false;
     }
-    auto result =  sps30.startMeasurement(true) == Sps30Error::Success;
-    if (result && (data.measurementsCounter++ % 168 == 0))
+    auto result = pipeline.submit(Sps30CommandPipeline::Command::ReadMeasurement);
+    result = pipeline.submit(Sps30CommandPipeline::Command::StopMeasurement) && result;
+    if (data.firmwareMajorVersion > 1)
     {
-        if (auto cleaningResult = sps30.startManualFanCleaning(); cleaningResult == Sps30Error::Success)
-        {
-            DEBUG_LOG("Manual cleaning started")
-        }
-        else
-        {
-            DEBUG_LOG("Manual cleaning start failed with the code " << (int)cleaningResult)
-        }
+        result = pipeline.submit(Sps30CommandPipeline::Command::Sleep) && result;
     }
     return result;
 }
 
+bool SPS30DataProvider::requestReadout()
+{
+    return data.sensorPresent && pipeline.submit(Sps30CommandPipeline::Command::ReadMeasurement);
+}
+
+bool SPS30DataProvider::waitIdle(int timeoutMilliseconds)
+{
+    return pipeline.waitIdle(timeoutMilliseconds);
+}
+
 bool SPS30DataProvider::hibernate()
 {
-    storage.set(sps30DataKey, data);
-    DEBUG_LOG("SPS30 data saved")
+    static_assert(sizeof(Data) <= PersistentLayout::budgetOf(sps30DataKey), "SPS30 record exceeds its budget");
+    PersistentLayout::store(storage, sps30DataKey, data);
+    WAKE_LOG("SPS30 data saved")
     return true;
 }
 
-bool SPS30DataProvider::getMeasureData(uint16_t &pm1, uint16_t &pm25, uint16_t &pm10)
+bool SPS30DataProvider::getMeasureData(uint16_t &pm1, uint16_t &pm25, uint16_t &pm10, int timeoutMilliseconds)
 {
-    if (!data.sensorPresent)
+    if (!data.sensorPresent || !pipeline.wait(Sps30CommandPipeline::Command::ReadMeasurement, timeoutMilliseconds))
     {
         return false;
     }
-    const auto result = sps30.readMeasurement();
-    if (std::holds_alternative<embedded::Sps30MeasurementData>(result))
-    {
-        const auto& measurementData = std::get<embedded::Sps30MeasurementData>(result);
-        if (measurementData.measureInFloat)
-        {
-            pm1 = (int)measurementData.floatData.mc_1p0;
-            pm25 = (int)measurementData.floatData.mc_2p5;
-            pm10 = (int)measurementData.floatData.mc_10p0;
-            return true;
-        }
-        else
-        {
-            pm1 = measurementData.unsignedData.mc_1p0;
-            pm25 = measurementData.unsignedData.mc_2p5;
-            pm10 = measurementData.unsignedData.mc_10p0;
-        }
-        return true;
-    }
-    return false;
+    const auto& massConcentration = pipeline.getMassConcentration();
+    pm1 = massConcentration.pm1;
+    pm25 = massConcentration.pm25;
+    pm10 = massConcentration.pm10;
+    return true;
 }
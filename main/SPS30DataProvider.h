@@ -1,7 +1,12 @@
 #pragma once
 
+#include "Sps30CommandPipeline.h"
+#include "ProbeBackoff.h"
+
 #include "SPS30/Sps30Uart.h"
 
+#include <string_view>
+
 namespace embedded
 {
 class PersistentStorage;
@@ -11,16 +16,25 @@ class SPS30DataProvider
 {
 public:
     SPS30DataProvider(embedded::PersistentStorage &storage, embedded::PacketUart& packetUart)
-    : sps30(packetUart), storage(storage)
+    : sps30(packetUart), pipeline(sps30), storage(storage)
     {
     }
 
     bool setup(bool wakeUp);
-    bool startMeasure();
-    bool stopMeasure()
-    {
-        return data.sensorPresent && sps30.stopMeasurement() == embedded::Sps30Error::Success;
-    }
+    // The sensor not found is probed again on the ProbeBackoff schedule, it has to be powered for the probe
+    bool isProbeDue(uint32_t now) const { return !data.sensorPresent && data.probeBackoff.isDue(now); }
+    // Identifies the sensor, returns true when it is found
+    bool probe(uint32_t now);
+    // Queues the measurement start, returns without waiting for the sensor
+    bool startMeasure(bool fanCleaning = false);
+    // Queues reading of the measurement followed by stop and sleep commands
+    bool requestMeasureData();
+    // Queues reading of the measurement only, the sensor keeps measuring
+    bool requestReadout();
+    // Waits for the data requested by requestMeasureData() or requestReadout()
+    bool getMeasureData(uint16_t &pm1, uint16_t &pm25, uint16_t &pm10, int timeoutMilliseconds);
+    // Waits for completion of all the queued commands
+    bool waitIdle(int timeoutMilliseconds);
 
     bool wakeUp()
     {
@@ -38,16 +52,19 @@ public:
     }
 
     bool hibernate();
-    bool getMeasureData(uint16_t &pm1, uint16_t &pm25, uint16_t &pm10);
     std::string_view getSpsSerial() const { return data.serialNumber.serial; }
 private:
+    // Probe and serial number reading, the version is read only for a sensor not in the flash cache
+    bool identify();
+
     struct Data
     {
-        uint32_t measurementsCounter = 0;
         embedded::Sps30SerialNumber serialNumber {};
-        int16_t firmwareMajorVersion;
+        int16_t firmwareMajorVersion = 0;
         bool sensorPresent = false;
+        ProbeBackoff probeBackoff;
     } data;
     embedded::Sps30Uart sps30;
+    Sps30CommandPipeline pipeline;
     embedded::PersistentStorage &storage;
 };
@@ -0,0 +1,85 @@
+#include "SensorTrace.h"
+
+#include "TimeFunctions.h"
+
+#include <esp_attr.h>
+#include <freertos/FreeRTOS.h>
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+// About 20 minutes of the battery wakes, 3 minutes of streaming
+constexpr size_t bufferRecords = 64;
+constexpr size_t drainThreshold = bufferRecords / 2;
+
+RTC_DATA_ATTR std::array<SensorTrace::Record, bufferRecords> traceBuffer;
+RTC_DATA_ATTR uint16_t traceHead = 0;
+RTC_DATA_ATTR uint16_t traceUsed = 0;
+RTC_DATA_ATTR uint32_t droppedRecords = 0;
+portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+
+bool append(const SensorTrace::Record& record)
+{
+    if (traceUsed == bufferRecords)
+    {
+        return false;
+    }
+    traceBuffer[(traceHead + traceUsed) % bufferRecords] = record;
+    ++traceUsed;
+    return true;
+}
+
+} // namespace
+
+void SensorTrace::write(Record record)
+{
+    const auto now = microsecondsNow();
+    record.seconds = static_cast<uint32_t>(now / microsecondsInSecond);
+    record.milliseconds = static_cast<uint16_t>(now % microsecondsInSecond / 1000);
+    portENTER_CRITICAL(&traceLock);
+    if (droppedRecords > 0)
+    {
+        Record dropped { .seconds = record.seconds, .milliseconds = record.milliseconds, .kind = Kind::Dropped
+                         , .values = { static_cast<int32_t>(droppedRecords), 0, 0 } };
+        if (append(dropped))
+        {
+            droppedRecords = 0;
+        }
+    }
+    if (droppedRecords > 0 || !append(record))
+    {
+        ++droppedRecords;
+    }
+    portEXIT_CRITICAL(&traceLock);
+}
+
+void SensorTrace::drainIfNeeded()
+{
+    if (traceUsed >= drainThreshold || droppedRecords > 0)
+    {
+        drain();
+    }
+}
+
+void SensorTrace::drain()
+{
+    if (traceUsed == 0)
+    {
+        return;
+    }
+    printf("STRC ");
+    for (; traceUsed > 0; --traceUsed)
+    {
+        uint8_t bytes[sizeof(Record)];
+        memcpy(bytes, &traceBuffer[traceHead], sizeof(bytes));
+        for (const auto byte : bytes)
+        {
+            printf("%02x", byte);
+        }
+        traceHead = (traceHead + 1) % bufferRecords;
+    }
+    printf("\n");
+    fflush(stdout);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Sensor trace: the raw readings and the link outcomes of a unit with their timestamps, captured with
+// -DSENSOR_TRACE=ON and replayed on the host by benchmark/host/TraceReplay.cpp to tune the wake logic.
+// The records are kept in a ring buffer in RTC memory and printed from time to time as "STRC <hex>" lines;
+// tools/sensor_trace.py extracts them from the serial capture into a trace file, the plain sequence of the records.
+// Everything is little endian, the values are kept as the drivers return them:
+//  Pth     - temperature in 0.01 °C, pressure in Pa Q24.8, humidity in % Q22.10 as of the BME280 compensation
+//  Pm      - PM1.0, PM2.5 and PM10 in µg/m³ as read from the SPS30
+//  Battery - raw ADC reading of the battery voltage divider
+//  Link    - sequence number of the record, attempts made, route
+//  Dropped - number of the records lost because the buffer was full
+namespace SensorTrace
+{
+
+enum class Kind : uint8_t
+{
+    Dropped = 0,
+    Pth = 1,
+    Pm = 2,
+    Battery = 3,
+    Link = 4,
+};
+
+// Status of the Pth and Pm records
+constexpr uint8_t valid = 1;
+// Status of the Link records, as EspNowTransport ends the exchange
+enum class LinkOutcome : uint8_t
+{
+    Lost = 0,
+    Acknowledged = 1,
+    Completed = 2,
+};
+
+struct __attribute__((packed)) Record
+{
+    // Wall clock time
+    uint32_t seconds = 0;
+    uint16_t milliseconds = 0;
+    Kind kind = Kind::Dropped;
+    uint8_t status = 0;
+    int32_t values[3] = {};
+};
+static_assert(sizeof(Record) == 20, "Trace record layout is shared with the host tools");
+
+inline Record pth(int32_t temperature, uint32_t pressure, uint32_t humidity, bool isValid)
+{
+    return { .kind = Kind::Pth, .status = isValid ? valid : uint8_t(0)
+             , .values = { temperature, static_cast<int32_t>(pressure), static_cast<int32_t>(humidity) } };
+}
+
+inline Record pm(int16_t pm01, int16_t pm25, int16_t pm10)
+{
+    return { .kind = Kind::Pm, .status = pm25 >= 0 ? valid : uint8_t(0), .values = { pm01, pm25, pm10 } };
+}
+
+inline Record battery(int voltageRaw)
+{
+    return { .kind = Kind::Battery, .values = { voltageRaw, 0, 0 } };
+}
+
+inline Record link(LinkOutcome outcome, uint32_t sequence, int attempts, uint8_t route)
+{
+    return { .kind = Kind::Link, .status = static_cast<uint8_t>(outcome)
+             , .values = { static_cast<int32_t>(sequence), attempts, route } };
+}
+
+// Stamps the record with the current time and appends it to the buffer
+void write(Record record);
+// Prints the buffered records when the buffer is filled above the threshold
+void drainIfNeeded();
+// Prints all the buffered records
+void drain();
+
+}
+
+#if defined(SENSOR_TRACE)
+#define TRACE_SENSOR(record) { SensorTrace::write(SensorTrace::record); }
+#else
+#define TRACE_SENSOR(record)
+#endif
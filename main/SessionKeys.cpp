@@ -0,0 +1,174 @@
+#include "SessionKeys.h"
+
+#include "AppConfig.h"
+#include "PersistentLayout.h"
+
+#include "PersistentStorage.h"
+
+#include <esp_idf_version.h>
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include <esp_random.h>
+#else
+#include <esp_system.h>
+#endif
+#include <mbedtls/md.h>
+#include <algorithm>
+#include <cstring>
+
+#include "BinaryLog.h"
+
+namespace
+{
+constexpr std::string_view keysDataTag = "KEYS";
+constexpr size_t addressSize = 6;
+// Acknowledged but unanswered exchanges in a row meaning the indoor unit has changed the epoch
+constexpr uint8_t staleThreshold = 3;
+
+using Digest = std::array<uint8_t, 32>;
+
+Digest hmac(const uint8_t* input, size_t size)
+{
+    Digest digest {};
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), AppConfig::preSharedKey.data()
+                    , AppConfig::preSharedKey.size(), input, size, digest.data());
+    return digest;
+}
+
+bool equalConstantTime(const uint8_t* left, const uint8_t* right, size_t size)
+{
+    uint8_t difference = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        difference |= left[i] ^ right[i];
+    }
+    return difference == 0;
+}
+} // namespace
+
+void SessionKeys::setup(bool wakeUp)
+{
+    if (wakeUp)
+    {
+        if (auto data = storage.get<State>(keysDataTag))
+        {
+            state = *data;
+        }
+    }
+}
+
+SessionKeys::Key SessionKeys::primaryKey() const
+{
+    return derive("PMK", 0, nullptr);
+}
+
+KeyExchange::KeyRequestMessage SessionKeys::makeRequest()
+{
+    state.pendingNonce = esp_random();
+    return { .magic = KeyExchange::requestMagic, .nonce = state.pendingNonce };
+}
+
+bool SessionKeys::onAnnounce(const KeyExchange::EpochAnnounceMessage& announce, const uint8_t* ownAddress)
+{
+    if (announce.magic != KeyExchange::announceMagic || state.pendingNonce == 0 || announce.nonce != state.pendingNonce)
+    {
+        return false;
+    }
+    std::array<uint8_t, 3 * sizeof(uint32_t) + addressSize> input;
+    memcpy(input.data(), &announce.magic, sizeof(uint32_t));
+    memcpy(input.data() + sizeof(uint32_t), &announce.epoch, sizeof(uint32_t));
+    memcpy(input.data() + 2 * sizeof(uint32_t), &announce.nonce, sizeof(uint32_t));
+    memcpy(input.data() + 3 * sizeof(uint32_t), ownAddress, addressSize);
+    const auto expected = hmac(input.data(), input.size());
+    if (!equalConstantTime(expected.data(), announce.tag.data(), announce.tag.size()))
+    {
+        WAKE_LOG("Epoch announce with a wrong tag is ignored")
+        return false;
+    }
+    state.pendingNonce = 0;
+    state.epoch = announce.epoch;
+    state.localKey = derive("LMK", announce.epoch, ownAddress);
+    state.unansweredExchanges = 0;
+    state.established = true;
+    WAKE_LOG("Session key established, epoch %u", static_cast<unsigned>(announce.epoch))
+    return true;
+}
+
+void SessionKeys::onExchange(bool acknowledged, bool answered)
+{
+    if (!state.established || !acknowledged)
+    {
+        // A lost frame says nothing about the keys
+        return;
+    }
+    state.unansweredExchanges = answered ? 0 : state.unansweredExchanges + 1;
+    if (state.unansweredExchanges >= staleThreshold)
+    {
+        WAKE_LOG("Session key of epoch %u looks stale", static_cast<unsigned>(state.epoch))
+        state.established = false;
+        state.unansweredExchanges = 0;
+    }
+}
+
+bool SessionKeys::hibernate()
+{
+    static_assert(sizeof(State) <= PersistentLayout::budgetOf(keysDataTag), "Session keys exceed their budget");
+    return PersistentLayout::store(storage, keysDataTag, state);
+}
+
+SessionKeys::Key SessionKeys::derive(const char* label, uint32_t epoch, const uint8_t* address)
+{
+    std::array<uint8_t, 3 + sizeof(epoch) + addressSize> input {};
+    const auto labelSize = std::min<size_t>(strlen(label), 3);
+    memcpy(input.data(), label, labelSize);
+    size_t size = labelSize;
+    if (address != nullptr)
+    {
+        memcpy(input.data() + size, &epoch, sizeof(epoch));
+        memcpy(input.data() + size + sizeof(epoch), address, addressSize);
+        size += sizeof(epoch) + addressSize;
+    }
+    const auto digest = hmac(input.data(), size);
+    Key key;
+    memcpy(key.data(), digest.data(), key.size());
+    return key;
+}
+
+SessionKeys::CorrectionTag SessionKeys::correctionTag(uint32_t sequence, int64_t receiveTime, int64_t currentTime
+                                                      , const uint8_t* unitAddress)
+{
+    std::array<uint8_t, 3 + sizeof(sequence) + 2 * sizeof(int64_t) + addressSize> input;
+    memcpy(input.data(), "TCR", 3);
+    memcpy(input.data() + 3, &sequence, sizeof(sequence));
+    memcpy(input.data() + 3 + sizeof(sequence), &receiveTime, sizeof(receiveTime));
+    memcpy(input.data() + 3 + sizeof(sequence) + sizeof(int64_t), &currentTime, sizeof(currentTime));
+    memcpy(input.data() + 3 + sizeof(sequence) + 2 * sizeof(int64_t), unitAddress, addressSize);
+    const auto digest = hmac(input.data(), input.size());
+    CorrectionTag tag;
+    memcpy(tag.data(), digest.data(), tag.size());
+    return tag;
+}
+
+bool SessionKeys::hasPreSharedKey()
+{
+    return std::any_of(AppConfig::preSharedKey.begin(), AppConfig::preSharedKey.end(), [](uint8_t byte) { return byte != 0; });
+}
+
+bool SessionKeys::verifyOffer(const OtaProtocol::OfferMessage& offer)
+{
+    if (!hasPreSharedKey())
+    {
+        return false;
+    }
+    std::array<uint8_t, 3 + offsetof(OtaProtocol::OfferMessage, tag)> input;
+    memcpy(input.data(), "OTA", 3);
+    memcpy(input.data() + 3, &offer, offsetof(OtaProtocol::OfferMessage, tag));
+    const auto digest = hmac(input.data(), input.size());
+    return equalConstantTime(digest.data(), offer.tag.data(), offer.tag.size());
+}
+
+bool SessionKeys::verifyCorrection(const CorrectionTag& tag, uint32_t sequence, int64_t receiveTime, int64_t currentTime
+                                   , const uint8_t* unitAddress)
+{
+    const auto expected = correctionTag(sequence, receiveTime, currentTime, unitAddress);
+    return equalConstantTime(expected.data(), tag.data(), tag.size());
+}
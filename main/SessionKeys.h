@@ -0,0 +1,66 @@
+#pragma once
+
+#include "KeyExchangeMessages.h"
+#include "OtaMessages.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace embedded
+{
+class PersistentStorage;
+}
+
+// ESP-NOW keys of the link to the indoor unit, derived from the pre-shared key in AppConfig.
+// The primary master key is HMAC-SHA256(psk, "PMK"), the local master key of the unit's peer entry is
+// HMAC-SHA256(psk, "LMK" | epoch | unit MAC), both truncated to 16 bytes; the frames are then encrypted and
+// authenticated by the CCMP hardware. The epoch comes from the indoor unit in the key handshake, which runs on
+// the power on and when the keys look stale: the indoor unit acknowledges the frames but never answers,
+// as it can't decrypt them after changing the epoch. The keys are kept in RTC memory between the wakes.
+class SessionKeys
+{
+public:
+    static constexpr size_t keySize = 16;
+    using Key = std::array<uint8_t, keySize>;
+    static constexpr size_t correctionTagSize = 8;
+    using CorrectionTag = std::array<uint8_t, correctionTagSize>;
+
+    explicit SessionKeys(embedded::PersistentStorage& storage) : storage(storage) {}
+
+    void setup(bool wakeUp);
+    bool isEstablished() const { return state.established; }
+    Key primaryKey() const;
+    const Key& localKey() const { return state.localKey; }
+    // Starts the handshake with a fresh nonce
+    KeyExchange::KeyRequestMessage makeRequest();
+    // Verifies the announce against the pending request and derives the local key, the address is the unit's own
+    bool onAnnounce(const KeyExchange::EpochAnnounceMessage& announce, const uint8_t* ownAddress);
+    // Accounts an exchange over the encrypted link: acknowledged by the indoor unit and answered or not
+    void onExchange(bool acknowledged, bool answered);
+    bool hibernate();
+
+    // HMAC-SHA256 of the label, epoch and address with the pre-shared key, truncated to the key size
+    static Key derive(const char* label, uint32_t epoch, const uint8_t* address);
+    // Tag of a time correction reply: HMAC-SHA256 with the pre-shared key over the sequence number, both times
+    // and the address of the answered unit, truncated to 8 bytes. Keyed with the pre-shared key rather than the
+    // local key, as a relay answers the units with their own local keys unknown to it
+    static CorrectionTag correctionTag(uint32_t sequence, int64_t receiveTime, int64_t currentTime, const uint8_t* unitAddress);
+    static bool verifyCorrection(const CorrectionTag& tag, uint32_t sequence, int64_t receiveTime, int64_t currentTime
+                                 , const uint8_t* unitAddress);
+    // False while the pre-shared key is left all zeros, the updates are refused then
+    static bool hasPreSharedKey();
+    // Checks the tag of the OTA offer, see OtaMessages.h
+    static bool verifyOffer(const OtaProtocol::OfferMessage& offer);
+
+private:
+    struct State
+    {
+        uint32_t epoch = 0;
+        uint32_t pendingNonce = 0;
+        Key localKey {};
+        uint8_t unansweredExchanges = 0;
+        bool established = false;
+    } state;
+    embedded::PersistentStorage& storage;
+};
@@ -0,0 +1,94 @@
+#include "Sha256.h"
+
+#include <cstring>
+
+namespace
+{
+constexpr std::array<uint32_t, 64> roundConstants = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+constexpr uint32_t rotateRight(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+void processBlock(Sha256::State& state, const uint8_t* block)
+{
+    std::array<uint32_t, 64> schedule;
+    for (size_t i = 0; i < 16; ++i)
+    {
+        schedule[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16)
+                      | (uint32_t(block[4 * i + 2]) << 8) | block[4 * i + 3];
+    }
+    for (size_t i = 16; i < schedule.size(); ++i)
+    {
+        const auto s0 = rotateRight(schedule[i - 15], 7) ^ rotateRight(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+        const auto s1 = rotateRight(schedule[i - 2], 17) ^ rotateRight(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+        schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+    }
+    auto v = state;
+    for (size_t i = 0; i < schedule.size(); ++i)
+    {
+        const auto s1 = rotateRight(v[4], 6) ^ rotateRight(v[4], 11) ^ rotateRight(v[4], 25);
+        const auto choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        const auto t1 = v[7] + s1 + choice + roundConstants[i] + schedule[i];
+        const auto s0 = rotateRight(v[0], 2) ^ rotateRight(v[0], 13) ^ rotateRight(v[0], 22);
+        const auto majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        v = { t1 + s0 + majority, v[0], v[1], v[2], v[3] + t1, v[4], v[5], v[6] };
+    }
+    for (size_t i = 0; i < state.size(); ++i)
+    {
+        state[i] += v[i];
+    }
+}
+} // namespace
+
+namespace Sha256
+{
+
+State initialState()
+{
+    return { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+}
+
+void update(State& state, const uint8_t* data, size_t size)
+{
+    for (size_t offset = 0; offset + blockSize <= size; offset += blockSize)
+    {
+        processBlock(state, data + offset);
+    }
+}
+
+Digest finish(State state, const uint8_t* tail, size_t tailSize, uint64_t totalSize)
+{
+    // The tail, 0x80, zero padding and the bit length fill one or two blocks
+    std::array<uint8_t, 2 * blockSize> padding {};
+    memcpy(padding.data(), tail, tailSize);
+    padding[tailSize] = 0x80;
+    const size_t paddedSize = tailSize + 1 + 8 <= blockSize ? blockSize : 2 * blockSize;
+    const auto bits = totalSize * 8;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        padding[paddedSize - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+    update(state, padding.data(), paddedSize);
+    Digest digest;
+    for (size_t i = 0; i < state.size(); ++i)
+    {
+        digest[4 * i] = static_cast<uint8_t>(state[i] >> 24);
+        digest[4 * i + 1] = static_cast<uint8_t>(state[i] >> 16);
+        digest[4 * i + 2] = static_cast<uint8_t>(state[i] >> 8);
+        digest[4 * i + 3] = static_cast<uint8_t>(state[i]);
+    }
+    return digest;
+}
+
+}
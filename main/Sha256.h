@@ -0,0 +1,24 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// SHA-256 with the intermediate state owned by the caller.
+// The hardware accelerated mbedtls context keeps its state in the SHA peripheral, so it can't be carried over
+// the deep sleep; this state is plain data kept in RTC memory, so a digest of a whole flash image is computed
+// in slices over several wakes. The data is fed in whole blocks, the rest goes to finish().
+namespace Sha256
+{
+
+constexpr size_t blockSize = 64;
+using State = std::array<uint32_t, 8>;
+using Digest = std::array<uint8_t, 32>;
+
+State initialState();
+// The size is a multiple of blockSize
+void update(State& state, const uint8_t* data, size_t size);
+// The tail is shorter than a block, totalSize counts all the bytes hashed including the tail
+Digest finish(State state, const uint8_t* tail, size_t tailSize, uint64_t totalSize);
+
+}
@@ -0,0 +1,159 @@
+#include "Sps30CommandPipeline.h"
+
+#include "FixedPoint.h"
+#include "WakeDeadline.h"
+
+#include <freertos/task.h>
+#include <array>
+#include <cstring>
+
+#include "BinaryLog.h"
+
+namespace
+{
+constexpr int maxAttempts = 3;
+constexpr size_t queueLength = 8;
+constexpr uint32_t stackSize = 2048;
+
+StaticQueue_t commandQueueBuffer;
+std::array<uint8_t, queueLength * sizeof(Sps30CommandPipeline::Command)> commandQueueStorage;
+StaticEventGroup_t eventsBuffer;
+StaticTask_t taskBuffer;
+std::array<StackType_t, stackSize / sizeof(StackType_t)> taskStack;
+
+EventBits_t doneBit(Sps30CommandPipeline::Command command)
+{
+    return 1u << (2 * static_cast<int>(command));
+}
+
+EventBits_t successBit(Sps30CommandPipeline::Command command)
+{
+    return 1u << (2 * static_cast<int>(command) + 1);
+}
+
+uint16_t floatToConcentration(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return FixedPoint::uint16FromFloatBits(bits);
+}
+
+} // namespace
+
+using embedded::Sps30Error;
+
+bool Sps30CommandPipeline::start()
+{
+    if (commandQueue != nullptr)
+    {
+        return true;
+    }
+    commandQueue = xQueueCreateStatic(queueLength, sizeof(Command), commandQueueStorage.data(), &commandQueueBuffer);
+    events = xEventGroupCreateStatic(&eventsBuffer);
+    return xTaskCreateStatic(taskFunction, "sps30", taskStack.size(), this, 5, taskStack.data(), &taskBuffer) != nullptr;
+}
+
+bool Sps30CommandPipeline::submit(Command command)
+{
+    if (!start())
+    {
+        return false;
+    }
+    xEventGroupClearBits(events, doneBit(command) | successBit(command));
+    if (xQueueSend(commandQueue, &command, 0) != pdTRUE)
+    {
+        return false;
+    }
+    // Only a queued command can be waited for
+    lastSubmitted = command;
+    return true;
+}
+
+bool Sps30CommandPipeline::wait(Command command, int timeoutMilliseconds)
+{
+    if (events == nullptr)
+    {
+        return false;
+    }
+    const auto bits = WakeDeadline::waitBits(events, doneBit(command), timeoutMilliseconds);
+    return (bits & doneBit(command)) && (bits & successBit(command));
+}
+
+bool Sps30CommandPipeline::waitIdle(int timeoutMilliseconds)
+{
+    if (events == nullptr)
+    {
+        return true;
+    }
+    const auto bits = WakeDeadline::waitBits(events, doneBit(lastSubmitted), timeoutMilliseconds);
+    return bits & doneBit(lastSubmitted);
+}
+
+void Sps30CommandPipeline::taskFunction(void* parameter)
+{
+    static_cast<Sps30CommandPipeline*>(parameter)->processCommands();
+}
+
+void Sps30CommandPipeline::processCommands()
+{
+    Command command;
+    while (xQueueReceive(commandQueue, &command, portMAX_DELAY) == pdTRUE)
+    {
+        const bool result = execute(command);
+        xEventGroupSetBits(events, doneBit(command) | (result ? successBit(command) : 0));
+    }
+}
+
+bool Sps30CommandPipeline::execute(Command command)
+{
+    for (int attempt = 0; attempt < maxAttempts; ++attempt)
+    {
+        auto result = Sps30Error::Success;
+        switch (command)
+        {
+            case Command::StartMeasurement: result = sps30.startMeasurement(!integerOutput); break;
+            case Command::StopMeasurement: result = sps30.stopMeasurement(); break;
+            case Command::ReadMeasurement:
+                if (readMeasurement())
+                {
+                    return true;
+                }
+                continue;
+            case Command::Sleep: result = sps30.sleep(); break;
+            case Command::WakeUp: result = sps30.wakeUp(); break;
+            case Command::StartFanCleaning: result = sps30.startManualFanCleaning(); break;
+        }
+        if (result == Sps30Error::Success)
+        {
+            return true;
+        }
+        WAKE_LOG("SPS30 command %d failed with the code %d", static_cast<int>(command), static_cast<int>(result))
+    }
+    WAKE_LOG("SPS30 command %d is not completed", static_cast<int>(command))
+    return false;
+}
+
+bool Sps30CommandPipeline::readMeasurement()
+{
+    const auto result = sps30.readMeasurement();
+    if (!std::holds_alternative<embedded::Sps30MeasurementData>(result))
+    {
+        // Also when there is no new measurement yet
+        return false;
+    }
+    const auto& measurementData = std::get<embedded::Sps30MeasurementData>(result);
+    if (measurementData.measureInFloat)
+    {
+        // The firmware 1.x, the float values are converted without the soft-float library
+        massConcentration.pm1 = floatToConcentration(measurementData.floatData.mc_1p0);
+        massConcentration.pm25 = floatToConcentration(measurementData.floatData.mc_2p5);
+        massConcentration.pm10 = floatToConcentration(measurementData.floatData.mc_10p0);
+    }
+    else
+    {
+        massConcentration.pm1 = measurementData.unsignedData.mc_1p0;
+        massConcentration.pm25 = measurementData.unsignedData.mc_2p5;
+        massConcentration.pm10 = measurementData.unsignedData.mc_10p0;
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "SPS30/Sps30Uart.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <cstdint>
+
+// Asynchronous SPS30 command queue.
+// Commands are queued without blocking the caller and executed one after another by a worker task through the
+// SHDLC driver, so the sensor I/O runs in parallel with the ADC, BME280 and radio work. The caller doesn't use
+// the driver itself while commands are pending.
+class Sps30CommandPipeline
+{
+public:
+    enum class Command : uint8_t
+    {
+        StartMeasurement,
+        StopMeasurement,
+        ReadMeasurement,
+        Sleep,
+        WakeUp,
+        StartFanCleaning,
+    };
+
+    struct MassConcentration
+    {
+        uint16_t pm1 = 0;
+        uint16_t pm25 = 0;
+        uint16_t pm10 = 0;
+    };
+
+    explicit Sps30CommandPipeline(embedded::Sps30Uart& sps30) : sps30(sps30) {}
+    // The measurement started after the call reports unsigned 16-bit values, supported by the firmware 2.0 and later
+    void useIntegerOutput(bool enable) { integerOutput = enable; }
+
+    bool submit(Command command);
+    // Waits for the completion of the last submitted command of the given type
+    bool wait(Command command, int timeoutMilliseconds);
+    // Waits until all the submitted commands are completed
+    bool waitIdle(int timeoutMilliseconds);
+    const MassConcentration& getMassConcentration() const { return massConcentration; }
+
+private:
+    static void taskFunction(void* parameter);
+    void processCommands();
+    bool execute(Command command);
+    bool readMeasurement();
+    bool start();
+
+    embedded::Sps30Uart& sps30;
+    QueueHandle_t commandQueue = nullptr;
+    EventGroupHandle_t events = nullptr;
+    Command lastSubmitted = Command::StartMeasurement;
+    MassConcentration massConcentration;
+    bool integerOutput = false;
+};
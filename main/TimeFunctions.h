@@ -11,6 +11,23 @@ inline constexpr int64_t microsecondsFromTimeval(const timeval &tv)
     return ((int64_t) tv.tv_sec) * microsecondsInSecond + tv.tv_usec;
 }
 
+// Sleep time to wake up right before the next whole minute, skipping to the following one if there is no time to boot
+inline constexpr int64_t sleepMicrosecondsTillNextMinute(int64_t nowMicroseconds, int64_t bootEstimationMicroseconds)
+{
+    const int64_t wholeMinutePast = (nowMicroseconds / microsecondsInMinute) * microsecondsInMinute;
+    const auto microsecondsTillNextMinute = wholeMinutePast + microsecondsInMinute - nowMicroseconds;
+    const auto sleepTime = (microsecondsTillNextMinute <= bootEstimationMicroseconds) ?
+                           microsecondsInMinute + microsecondsTillNextMinute : microsecondsTillNextMinute;
+    return sleepTime - bootEstimationMicroseconds;
+}
+
+// Sleep time to wake up right before the end of the second, at least a millisecond
+inline constexpr int64_t sleepMicrosecondsTillSecondEnd(int64_t second, int64_t nowMicroseconds, int64_t bootEstimationMicroseconds)
+{
+    const auto sleepTime = (second + 1) * microsecondsInSecond - bootEstimationMicroseconds - nowMicroseconds;
+    return sleepTime > 1000 ? sleepTime : 1000;
+}
+
 inline int64_t microsecondsNow()
 {
     timeval tv {};
@@ -0,0 +1,147 @@
+#include "WakeDeadline.h"
+
+#include "HardwareSensorControl.h"
+#include "PersistentLayout.h"
+#include "TimeFunctions.h"
+
+#include "PersistentStorage.h"
+#include "esp32-esp-idf/SleepFunctions.h"
+
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "BinaryLog.h"
+
+namespace
+{
+constexpr std::string_view deadlineDataTag = "WDLN";
+// Counted from the boot, so the startup is included
+constexpr int64_t wakeDeadlineMicroseconds = 3000000;
+constexpr int64_t hardLimitMicroseconds = 5000000;
+
+constexpr std::array<int, static_cast<size_t>(WakeDeadline::Phase::Count)> phaseBudgets = {
+        150,  // Pth: the forced BME280 measurement takes up to 40 ms
+        400,  // Sps30Readout: the read command is queued well before
+        1000, // Sps30Shutdown: stop and sleep commands with the retries
+        1000, // Radio: the 800 ms slot and the retries
+        600,  // Ota: one chunk window and the flash writes
+};
+
+// Time the aborted wake has to reach hibernate() before the sleep is forced
+constexpr int64_t forcedSleepMicroseconds = 1000000;
+// Slice of the waits checking for the abort
+constexpr int abortCheckMilliseconds = 20;
+
+// Out of the persistent storage, as the timer task can't touch it while the main task may be writing
+RTC_DATA_ATTR uint16_t abortedWakes = 0;
+esp_timer_handle_t abortTimer = nullptr;
+std::atomic<bool> aborted { false };
+
+void onHardLimit(void* /*parameter*/)
+{
+    if (!aborted)
+    {
+        // The waits return, the phases get no budget and the main task goes on to hibernate() and deep sleep
+        aborted = true;
+        ++abortedWakes;
+        WAKE_LOG("Wake hard limit exceeded, aborting the wake")
+        esp_timer_start_once(abortTimer, forcedSleepMicroseconds);
+        return;
+    }
+    // The main task is stuck: the sensors are powered off and the state of the previous wake, kept in RTC memory,
+    // is continued by the next wake
+    WAKE_LOG("Aborted wake is not finished, forcing deep sleep")
+    HardwareSensorControl::initStepUpControl(false);
+    const auto sleepMicroseconds = sleepMicrosecondsTillNextMinute(microsecondsNow(), HardwareSensorControl::bootEstimationMicroseconds);
+    embedded::deepSleep(static_cast<uint32_t>(sleepMicroseconds / 1000));
+}
+} // namespace
+
+void WakeDeadline::setup(bool wakeUp)
+{
+    if (wakeUp)
+    {
+        if (auto data = storage.get<Counters>(deadlineDataTag))
+        {
+            counters = *data;
+        }
+    }
+    const esp_timer_create_args_t timerArgs {
+            .callback = onHardLimit, .arg = nullptr, .dispatch_method = ESP_TIMER_TASK, .name = "wakeLimit"
+            , .skip_unhandled_events = false
+    };
+    if (esp_timer_create(&timerArgs, &abortTimer) == ESP_OK)
+    {
+        esp_timer_start_once(abortTimer, std::max<int64_t>(hardLimitMicroseconds - esp_timer_get_time(), 0));
+    }
+}
+
+int WakeDeadline::start(Phase phase)
+{
+    const auto index = static_cast<size_t>(phase);
+    const auto now = esp_timer_get_time();
+    const auto left = aborted ? 0 : static_cast<int>(std::max<int64_t>(wakeDeadlineMicroseconds - now, 0) / 1000);
+    phaseStarted[index] = now;
+    phaseBudget[index] = std::min(phaseBudgets[index], left);
+    return phaseBudget[index];
+}
+
+bool WakeDeadline::finish(Phase phase)
+{
+    const auto index = static_cast<size_t>(phase);
+    const auto elapsedMilliseconds = (esp_timer_get_time() - phaseStarted[index]) / 1000;
+    if (elapsedMilliseconds < phaseBudget[index])
+    {
+        return true;
+    }
+    if (counters.overruns[index] < UINT16_MAX)
+    {
+        ++counters.overruns[index];
+    }
+    WAKE_LOG("Phase %d overrun, %d ms", static_cast<int>(index), static_cast<int>(elapsedMilliseconds))
+    return false;
+}
+
+bool WakeDeadline::isAborted()
+{
+    return aborted;
+}
+
+EventBits_t WakeDeadline::waitBits(EventGroupHandle_t group, EventBits_t bits, int timeoutMilliseconds)
+{
+    EventBits_t result = 0;
+    for (int left = timeoutMilliseconds; !aborted; left -= abortCheckMilliseconds)
+    {
+        result = xEventGroupWaitBits(group, bits, pdFALSE, pdTRUE, pdMS_TO_TICKS(std::min(left, abortCheckMilliseconds)));
+        if ((result & bits) == bits || left <= abortCheckMilliseconds)
+        {
+            break;
+        }
+    }
+    return result;
+}
+
+void WakeDeadline::disarm()
+{
+    if (abortTimer != nullptr)
+    {
+        esp_timer_stop(abortTimer);
+    }
+}
+
+void WakeDeadline::fillReport(DiagnosticsMessage& report) const
+{
+    static_assert(sizeof(report.phaseOverruns) == sizeof(counters.overruns), "Overrun counters mismatch");
+    memcpy(report.phaseOverruns, counters.overruns.data(), sizeof(report.phaseOverruns));
+    report.abortedWakes = abortedWakes;
+}
+
+bool WakeDeadline::hibernate()
+{
+    disarm();
+    static_assert(sizeof(Counters) <= PersistentLayout::budgetOf(deadlineDataTag), "Deadline record exceeds its budget");
+    return PersistentLayout::store(storage, deadlineDataTag, counters);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "DiagnosticsMessage.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace embedded
+{
+class PersistentStorage;
+}
+
+// Time budget of the wake.
+// Every blocking phase asks for its budget, limited by the time left until the wake deadline, and reports
+// when it is done; a phase running out of its budget is counted as an overrun and the caller treats its data
+// as invalid. The counters are kept in RTC memory and reported in the diagnostics message.
+// If the wake still runs past the hard limit, a timer aborts it: the waits return early and the following phases
+// get no budget, so the wake goes on to hibernate() and deep sleep. If it doesn't get there in a second, the timer
+// powers the sensors off and forces the deep sleep without saving the wake state.
+class WakeDeadline
+{
+public:
+    enum class Phase : uint8_t
+    {
+        Pth,
+        Sps30Readout,
+        Sps30Shutdown,
+        Radio,
+        Ota,
+        Count
+    };
+
+    explicit WakeDeadline(embedded::PersistentStorage& storage) : storage(storage) {}
+
+    void setup(bool wakeUp);
+    // Starts the phase and returns its budget in milliseconds, 0 if the wake deadline has passed
+    int start(Phase phase);
+    // Returns false and counts the overrun if the phase took its whole budget
+    bool finish(Phase phase);
+    // Stops the hard limit timer for a wake that is not bound by the deadline
+    void disarm();
+    // True once the hard limit is exceeded
+    static bool isAborted();
+    // Waits for all the bits like xEventGroupWaitBits without clearing them, returns early when the wake is aborted
+    static EventBits_t waitBits(EventGroupHandle_t group, EventBits_t bits, int timeoutMilliseconds);
+    void fillReport(DiagnosticsMessage& report) const;
+    bool hibernate();
+
+private:
+    struct Counters
+    {
+        std::array<uint16_t, static_cast<size_t>(Phase::Count)> overruns {};
+    } counters;
+    std::array<int64_t, static_cast<size_t>(Phase::Count)> phaseStarted {};
+    std::array<int, static_cast<size_t>(Phase::Count)> phaseBudget {};
+    embedded::PersistentStorage& storage;
+};
@@ -0,0 +1,44 @@
+#include "WakeProfiler.h"
+
+#include <array>
+#include <cstdio>
+
+namespace
+{
+struct PhaseTotals
+{
+    int64_t microseconds = 0;
+    uint64_t cycles = 0;
+    uint32_t count = 0;
+};
+
+constexpr std::array<const char*, static_cast<size_t>(WakeProfiler::Phase::Count)> phaseNames = {
+        "setup", "pth", "sps30", "radio", "hibernate"
+};
+
+std::array<PhaseTotals, static_cast<size_t>(WakeProfiler::Phase::Count)> phaseTotals;
+}
+
+void WakeProfiler::add(Phase phase, int64_t microseconds, uint32_t cycles)
+{
+    auto& totals = phaseTotals[static_cast<size_t>(phase)];
+    totals.microseconds += microseconds;
+    totals.cycles += cycles;
+    ++totals.count;
+}
+
+void WakeProfiler::report()
+{
+    for (size_t i = 0; i < phaseTotals.size(); ++i)
+    {
+        if (phaseTotals[i].count > 0)
+        {
+            // The average CPU frequency shows the share of the phase spent at the low clock or in light sleep
+            const auto mhz = phaseTotals[i].microseconds > 0 ? static_cast<double>(phaseTotals[i].cycles) / phaseTotals[i].microseconds : 0.;
+            printf("BENCH {\"kind\":\"wake\",\"name\":\"%s\",\"us\":%lld,\"cycles\":%llu,\"mhz\":%.1f}\n", phaseNames[i],
+                   static_cast<long long>(phaseTotals[i].microseconds), static_cast<unsigned long long>(phaseTotals[i].cycles), mhz);
+        }
+    }
+    printf("BENCH {\"kind\":\"wake\",\"name\":\"awake\",\"us\":%lld}\n", static_cast<long long>(esp_timer_get_time()));
+    fflush(stdout);
+}
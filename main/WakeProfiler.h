@@ -0,0 +1,57 @@
+#pragma once
+
+#include <esp_idf_version.h>
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include <esp_cpu.h>
+#else
+#include <hal/cpu_hal.h>
+#endif
+#include <esp_timer.h>
+#include <cstdint>
+
+inline uint32_t cpuCycleCount()
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    return esp_cpu_get_cycle_count();
+#else
+    return cpu_hal_get_cycle_count();
+#endif
+}
+
+// Accumulates CPU cycles and wall time spent in the wake phases.
+// Enabled by the WAKE_PROFILING option; the results are printed as JSON lines prefixed with "BENCH".
+class WakeProfiler
+{
+public:
+    enum class Phase : uint8_t
+    {
+        Setup,
+        Pth,
+        Sps30,
+        Radio,
+        Hibernate,
+        Count
+    };
+
+    class Scope
+    {
+    public:
+        explicit Scope(Phase phase) : phase(phase), startMicroseconds(esp_timer_get_time()), startCycles(cpuCycleCount()) {}
+        ~Scope() { WakeProfiler::add(phase, esp_timer_get_time() - startMicroseconds, cpuCycleCount() - startCycles); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        Phase phase;
+        int64_t startMicroseconds;
+        uint32_t startCycles;
+    };
+
+    static void add(Phase phase, int64_t microseconds, uint32_t cycles);
+    static void report();
+};
+
+#ifdef WAKE_PROFILING
+#define WAKE_PHASE(phase) WakeProfiler::Scope wakePhaseScope(WakeProfiler::Phase::phase);
+#else
+#define WAKE_PHASE(phase)
+#endif
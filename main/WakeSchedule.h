@@ -0,0 +1,59 @@
+#pragma once
+
+#include "WakeScheduler.h"
+
+#include <ctime>
+
+// Jobs of the battery wake schedule, shared with the host replay of sensor traces.
+// The phases are counted from the multiples of the period in UTC, the same as the local time in the whole-hour
+// time zones: the measurement exchange runs at the 59th second of every minute, so the record reaches the indoor unit
+// right before the whole minute, and the PM measurement starts in the 59th minute of every hour.
+namespace WakeSchedule
+{
+
+enum Job : WakeScheduler::JobId
+{
+    Measurement,
+    PmMeasurement,
+    PmReadout,
+    FanCleaning,
+    BatteryCheck,
+};
+
+using Priority = WakeScheduler::Priority;
+
+// Seconds the SPS30 measures before the readout
+constexpr int pmMeasurementSeconds = 30;
+
+constexpr WakeScheduler::Job measurement { .period = 60, .phase = 59, .window = 0, .cost = 15, .priority = Priority::High };
+constexpr WakeScheduler::Job pmMeasurement {
+        .period = 3600, .phase = 59 * 60, .window = 59, .cost = 1800, .priority = Priority::Normal };
+// The started measurement is always read, the sensor is stopped with it
+constexpr WakeScheduler::Job pmReadout { .window = 5, .cost = 20, .priority = Priority::High };
+// Runs with the next PM measurement start once a week, it needs the fan running
+constexpr WakeScheduler::Job fanCleaning {
+        .period = 7 * 24 * 3600, .phase = 59 * 60, .window = 24 * 3600, .cost = 300, .priority = Priority::Low };
+// The battery voltage sent with the records, also between the PM measurements
+constexpr WakeScheduler::Job batteryCheck { .period = 10 * 60, .phase = 0, .window = 60, .cost = 1, .priority = Priority::Low };
+
+// Charge budget of a wake while the power is insufficient, enough for everything but the SPS30
+constexpr uint32_t lowPowerBudget = 100;
+constexpr uint32_t unlimitedBudget = UINT32_MAX;
+
+// The clock is set by the indoor unit
+inline bool isTimeSynchronized(time_t time)
+{
+    return time > 1692025000;
+}
+
+// Starts the schedule on the first wake with the synchronized clock; the PM measurement and the fan cleaning run
+// right away, like after every power on
+inline void start(WakeScheduler& scheduler, uint32_t now)
+{
+    scheduler.schedule(Measurement, measurement, now, false);
+    scheduler.schedule(PmMeasurement, pmMeasurement, now, true);
+    scheduler.schedule(FanCleaning, fanCleaning, now, true);
+    scheduler.schedule(BatteryCheck, batteryCheck, now, false);
+}
+
+}
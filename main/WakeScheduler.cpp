@@ -0,0 +1,158 @@
+#include "WakeScheduler.h"
+
+#include <algorithm>
+
+namespace
+{
+// First run of the periodic job strictly after the time
+uint32_t nextRun(const WakeScheduler::Job& job, uint32_t after)
+{
+    const auto sincePhase = (after % job.period + job.period - job.phase % job.period) % job.period;
+    return after - sincePhase + job.period;
+}
+
+uint32_t latestRun(const WakeScheduler::Entry& entry)
+{
+    return entry.due + entry.job.window;
+}
+} // namespace
+
+bool WakeScheduler::isActive() const
+{
+    return std::any_of(state.entries.begin(), state.entries.end(), [](const auto& entry) { return entry.due != 0; });
+}
+
+void WakeScheduler::schedule(JobId id, const Job& job, uint32_t now, bool runNow)
+{
+    if (id >= maxJobs || job.period == 0)
+    {
+        return;
+    }
+    auto& entry = state.entries[id];
+    entry.job = job;
+    entry.due = runNow ? now : nextRun(job, now - 1);
+}
+
+void WakeScheduler::scheduleOnce(JobId id, const Job& job, uint32_t at)
+{
+    if (id >= maxJobs)
+    {
+        return;
+    }
+    auto& entry = state.entries[id];
+    entry.job = job;
+    entry.job.period = 0;
+    entry.due = at;
+}
+
+void WakeScheduler::cancel(JobId id)
+{
+    if (id < maxJobs)
+    {
+        state.entries[id].due = 0;
+    }
+}
+
+WakeScheduler::JobMask WakeScheduler::collectDue(uint32_t now, uint32_t budget)
+{
+    for (auto& entry : state.entries)
+    {
+        if (entry.due != 0 && latestRun(entry) < now)
+        {
+            entry.due = entry.job.period != 0 ? nextRun(entry.job, now - 1) : 0;
+        }
+    }
+    JobMask due = 0;
+    uint32_t spent = 0;
+    for (const auto priority : { Priority::High, Priority::Normal, Priority::Low })
+    {
+        for (JobId id = 0; id < maxJobs; ++id)
+        {
+            const auto& entry = state.entries[id];
+            if (entry.due == 0 || entry.due > now || entry.job.priority != priority)
+            {
+                continue;
+            }
+            if (priority == Priority::High || spent + entry.job.cost <= budget)
+            {
+                due |= maskOf(id);
+                spent += entry.job.cost;
+            }
+        }
+    }
+    return due;
+}
+
+void WakeScheduler::complete(JobId id, uint32_t now)
+{
+    if (id >= maxJobs)
+    {
+        return;
+    }
+    auto& entry = state.entries[id];
+    entry.due = entry.job.period != 0 ? nextRun(entry.job, now) : 0;
+}
+
+uint32_t WakeScheduler::nextWake(uint32_t now) const
+{
+    struct Run
+    {
+        uint32_t due;
+        uint32_t latest;
+    };
+    std::array<Run, maxJobs> runs {};
+    size_t count = 0;
+    for (const auto& entry : state.entries)
+    {
+        if (entry.due == 0)
+        {
+            continue;
+        }
+        auto run = Run { entry.due, latestRun(entry) };
+        if (run.latest <= now)
+        {
+            // Run or missed in this wake
+            if (entry.job.period == 0)
+            {
+                continue;
+            }
+            run.due = nextRun(entry.job, now);
+            run.latest = run.due + entry.job.window;
+        }
+        else if (run.due <= now)
+        {
+            // Due but left out by the charge budget, retried at the end of its window
+            run.due = run.latest;
+        }
+        runs[count++] = run;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    const auto first = runs.begin();
+    const auto last = runs.begin() + count;
+    auto wake = std::min_element(first, last, [](const Run& a, const Run& b) { return a.due < b.due; })->due;
+    // The wake is delayed to the next due job only when all the jobs grouped so far can still wait for it
+    for (;;)
+    {
+        uint32_t limit = UINT32_MAX;
+        uint32_t next = UINT32_MAX;
+        std::for_each(first, last, [&](const Run& run) {
+            if (run.due <= wake)
+            {
+                limit = std::min(limit, run.latest);
+            }
+            else
+            {
+                next = std::min(next, run.due);
+            }
+        });
+        if (next > limit)
+        {
+            break;
+        }
+        wake = next;
+    }
+    return wake;
+}
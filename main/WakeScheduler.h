@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Plans the wakes of the battery schedule.
+// A job is due at the multiples of its period shifted by the phase, in wall clock seconds, or once at the given
+// time. A wake runs in the second a job is due, the unit boots to be running right before its end. A job may run
+// up to its window later than due, so jobs falling due close together share one wake: the next wake is at the
+// earliest due time, delayed only when a later due job can join it within the windows of all the grouped jobs. A
+// job not run within its window is missed and waits for its next time. The charge budget of a wake admits the due jobs by priority, the high priority ones always run.
+// Hardware independent, the owner keeps the state in the persistent storage.
+class WakeScheduler
+{
+public:
+    static constexpr size_t maxJobs = 6;
+    using JobId = uint8_t;
+    using JobMask = uint32_t;
+
+    enum class Priority : uint8_t
+    {
+        Low,
+        Normal,
+        High,
+    };
+
+    struct Job
+    {
+        // Seconds between the runs, 0 for a one-shot job
+        uint32_t period = 0;
+        // Offset of the runs from the multiples of the period
+        uint32_t phase = 0;
+        // Seconds the run may be delayed to share a wake
+        uint32_t window = 0;
+        // Estimated charge of a run, mA * s
+        uint16_t cost = 0;
+        Priority priority = Priority::Normal;
+    };
+
+    struct Entry
+    {
+        Job job;
+        // Time of the next run, 0 when the job is not scheduled
+        uint32_t due = 0;
+    };
+
+    struct State
+    {
+        std::array<Entry, maxJobs> entries {};
+    };
+
+    void restore(const State& restored) { state = restored; }
+    const State& getState() const { return state; }
+    // True when any job is scheduled
+    bool isActive() const;
+    bool isScheduled(JobId id) const { return id < maxJobs && state.entries[id].due != 0; }
+
+    // Schedules a periodic job, the first run now or at its next time
+    void schedule(JobId id, const Job& job, uint32_t now, bool runNow);
+    // Schedules a one-shot job at the given time, the period of the job is ignored
+    void scheduleOnce(JobId id, const Job& job, uint32_t at);
+    void cancel(JobId id);
+
+    // Moves the missed jobs to their next time and returns the due ones fitting into the charge budget
+    JobMask collectDue(uint32_t now, uint32_t budget);
+    // The job is run, a periodic one is moved to its next time
+    void complete(JobId id, uint32_t now);
+    // Second of the next wake, 0 when nothing is scheduled
+    uint32_t nextWake(uint32_t now) const;
+
+    static constexpr JobMask maskOf(JobId id) { return JobMask(1) << id; }
+
+private:
+    State state;
+};
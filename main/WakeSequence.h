@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// Resumable sequences spanning several wakes.
+// A sequence is a function written as straight-line code between SEQUENCE_BEGIN and SEQUENCE_END; the macros turn
+// it into a state machine switching over its resume points, the way protothreads do. The frame keeps only the
+// resume point, so it is stored in the owner's persistent record. A yield saves the frame and returns, the next
+// wake continues right after it without repeating the steps already done. The sequence doesn't plan the wakes,
+// a wait for a time is a wait for a WakeScheduler job due then.
+// Restrictions of the switch-based implementation:
+//  - the locals don't survive a yield, the values needed later have to be in the owner's persistent record
+//  - a yield can't be placed inside a nested switch or a block declaring initialized locals
+//  - one yield per source line, the line number is the resume point
+struct SequenceFrame
+{
+    // Resume point, 0 is the beginning of the sequence
+    uint16_t step = 0;
+};
+
+enum class SequenceState : uint8_t
+{
+    Waiting,
+    Finished,
+};
+
+#define SEQUENCE_BEGIN(frame) SequenceFrame& sequenceFrame = (frame); switch (sequenceFrame.step) { case 0:
+
+// Checks the condition on every wake, continues with the next statement once it holds
+#define SEQUENCE_WAIT_UNTIL(condition) \
+    sequenceFrame.step = __LINE__; \
+    [[fallthrough]]; \
+    case __LINE__: \
+    if (!(condition)) \
+    { \
+        return SequenceState::Waiting; \
+    }
+
+// Resets the frame, so the next run starts from the beginning
+#define SEQUENCE_END() } sequenceFrame = SequenceFrame {}; return SequenceState::Finished;
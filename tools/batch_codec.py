@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Host side decoder of the batched uplink frames (main/BatchCodec.h).
+
+Reads frames as hex strings, one per line, and prints the samples as CSV:
+timestamp_ms,humidity,temperature,pressure,pm01,pm25,pm10,voltage,flags
+"""
+
+import argparse
+import struct
+import sys
+
+BATCH_MAGIC = 0x48435442
+FIXED_POINT = 0
+XOR_FLOAT = 1
+HUMIDITY_SCALE = 100.0
+TEMPERATURE_SCALE = 100.0
+PRESSURE_SCALE = 10.0
+VOLTAGE_SCALE = 1000.0
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.position = 0
+
+    def byte(self):
+        if self.position >= len(self.data):
+            raise ValueError('truncated frame')
+        value = self.data[self.position]
+        self.position += 1
+        return value
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            byte = self.byte()
+            value |= (byte & 0x7f) << shift
+            if not byte & 0x80:
+                return value
+            shift += 7
+
+    def signed_varint(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+
+def read_deltas(reader, count):
+    values = []
+    value = 0
+    for _ in range(count):
+        value += reader.signed_varint()
+        values.append(value)
+    return values
+
+
+def read_xor(reader, count):
+    values = []
+    value = 0
+    for _ in range(count):
+        control = reader.byte()
+        if control:
+            leading = (control >> 2) & 0x03
+            trailing = control & 0x03
+            difference = 0
+            for index in range(4 - leading - trailing):
+                difference |= reader.byte() << (8 * index)
+            value ^= difference << (8 * trailing)
+        values.append(struct.unpack('<f', struct.pack('<I', value))[0])
+    return values
+
+
+def decode(frame):
+    reader = Reader(frame)
+    magic = struct.unpack('<I', bytes(reader.byte() for _ in range(4)))[0]
+    options = reader.byte()
+    count = reader.byte()
+    if magic != BATCH_MAGIC or count == 0 or options not in (FIXED_POINT, XOR_FLOAT):
+        raise ValueError('not a batch frame')
+    timestamps = [reader.signed_varint()]
+    delta = 0
+    for _ in range(count - 1):
+        delta += reader.signed_varint()
+        timestamps.append(timestamps[-1] + delta)
+    if options == XOR_FLOAT:
+        humidity, temperature, pressure = (read_xor(reader, count) for _ in range(3))
+    else:
+        humidity = [value / HUMIDITY_SCALE for value in read_deltas(reader, count)]
+        temperature = [value / TEMPERATURE_SCALE for value in read_deltas(reader, count)]
+        pressure = [value / PRESSURE_SCALE for value in read_deltas(reader, count)]
+    pm01, pm25, pm10 = (read_deltas(reader, count) for _ in range(3))
+    voltage = [value / VOLTAGE_SCALE for value in read_deltas(reader, count)]
+    flags = [reader.varint() for _ in range(count)]
+    if reader.position != len(frame):
+        raise ValueError('trailing bytes in frame')
+    return list(zip(timestamps, humidity, temperature, pressure, pm01, pm25, pm10, voltage, flags))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('frames', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    args = parser.parse_args()
+
+    for line in args.frames:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            samples = decode(bytes.fromhex(line))
+        except ValueError as error:
+            print('<%s: %s>' % (error, line), file=sys.stderr)
+            continue
+        for sample in samples:
+            print('%d,%.2f,%.2f,%.1f,%d,%d,%d,%.3f,%d' % sample)
+
+
+if __name__ == '__main__':
+    main()
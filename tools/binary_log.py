@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Host side of the deferred wake-path log (main/BinaryLog.h).
+
+table   - collect WAKE_LOG format strings from the sources and write the format table (run by the build)
+decode  - turn "BLOG <hex>" lines of a serial capture back into text using the format table
+"""
+
+import argparse
+import codecs
+import json
+import pathlib
+import re
+import struct
+import sys
+
+CALL_PATTERN = re.compile(r'WAKE_LOG\(\s*"((?:[^"\\]|\\.)*)"')
+CONVERSION_PATTERN = re.compile(r'%[-+ #0]*\d*(?:\.\d+)?(ll|l|h|hh)?([diuxXf%])')
+DROPPED_RECORDS_ID = 0
+
+
+def format_id(text):
+    value = 2166136261
+    for byte in text.encode():
+        value ^= byte
+        value = (value * 16777619) & 0xffffffff
+    return value
+
+
+def argument_codes(text):
+    codes = ''
+    for length, conversion in CONVERSION_PATTERN.findall(text):
+        if conversion == '%':
+            continue
+        if conversion == 'f':
+            codes += 'f'
+        elif conversion in 'di':
+            codes += 'q' if length == 'll' else 'i'
+        else:
+            codes += 'Q' if length == 'll' else 'I'
+    return codes
+
+
+def build_table(sources):
+    table = {}
+    for source in sources:
+        for path in sorted(pathlib.Path(source).rglob('*')):
+            if path.suffix not in ('.cpp', '.h'):
+                continue
+            for match in CALL_PATTERN.finditer(path.read_text()):
+                text = codecs.decode(match.group(1), 'unicode_escape')
+                key = '%08x' % format_id(text)
+                if key in table and table[key]['format'] != text:
+                    sys.exit('format hash collision: "%s" and "%s"' % (text, table[key]['format']))
+                table[key] = {'format': text, 'arguments': argument_codes(text), 'source': path.name}
+    return table
+
+
+def decode_records(data, table):
+    offset = 0
+    while offset < len(data):
+        size = data[offset]
+        if size < 5 or offset + size > len(data):
+            yield '<corrupted record at offset %d>' % offset
+            return
+        (record_id,) = struct.unpack_from('<I', data, offset + 1)
+        arguments = data[offset + 5:offset + size]
+        offset += size
+        if record_id == DROPPED_RECORDS_ID:
+            yield '<%d records dropped>' % struct.unpack('<I', arguments)[0]
+            continue
+        entry = table.get('%08x' % record_id)
+        if entry is None:
+            yield '<unknown format %08x: %s>' % (record_id, arguments.hex())
+            continue
+        codes = '<' + entry['arguments']
+        if struct.calcsize(codes) != len(arguments):
+            yield '<argument size mismatch for "%s">' % entry['format']
+            continue
+        values = struct.unpack(codes, arguments)
+        yield CONVERSION_PATTERN.sub(lambda match: match.group(0).replace(match.group(1) or '', '', 1),
+                                     entry['format']) % values
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+    table = commands.add_parser('table')
+    table.add_argument('sources', nargs='+')
+    table.add_argument('-o', '--output', required=True)
+    decode = commands.add_parser('decode')
+    decode.add_argument('--table', required=True)
+    decode.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    args = parser.parse_args()
+
+    if args.command == 'table':
+        formats = build_table(args.sources)
+        pathlib.Path(args.output).write_text(json.dumps(formats, indent=1, sort_keys=True))
+    else:
+        formats = json.loads(pathlib.Path(args.table).read_text())
+        for line in args.log:
+            line = line.strip()
+            if not line.startswith('BLOG '):
+                print(line)
+                continue
+            for text in decode_records(bytes.fromhex(line[5:]), formats):
+                print(text)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Compare two benchmark captures (BENCH JSON lines from the host, target or wake profiling output).
+
+Exits with a non-zero status when any result got slower than the threshold.
+"""
+
+import argparse
+import json
+import sys
+
+METRICS = ('cycles_per_op', 'ns_per_op', 'cycles', 'us')
+
+
+def load(path):
+    results = {}
+    with open(path) as file:
+        for line in file:
+            position = line.find('BENCH ')
+            if position < 0:
+                continue
+            result = json.loads(line[position + 6:])
+            if 'name' not in result:
+                continue
+            key = (result.get('kind'), result.get('platform', ''), result['name'])
+            results.setdefault(key, []).append(result)
+    return results
+
+
+def metric(results):
+    for name in METRICS:
+        values = [result[name] for result in results if name in result]
+        if values:
+            return name, sorted(values)[len(values) // 2]
+    return None, None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('baseline')
+    parser.add_argument('current')
+    parser.add_argument('--threshold', type=float, default=10.0, help='allowed slowdown in percent')
+    args = parser.parse_args()
+
+    baseline, current = load(args.baseline), load(args.current)
+    regressions = 0
+    for key in sorted(set(baseline) & set(current)):
+        name, before = metric(baseline[key])
+        _, after = metric(current[key])
+        if name is None or not before:
+            continue
+        change = 100.0 * (after - before) / before
+        regressed = change > args.threshold
+        regressions += regressed
+        print('%-8s %-10s %-32s %-14s %12.1f -> %12.1f %+7.1f%%%s' % (
+            key[0], key[1], key[2], name, before, after, change, '  REGRESSION' if regressed else ''))
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == '__main__':
+    main()
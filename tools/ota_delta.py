@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+"""Delta generation and sender stand-in for the ESP-NOW OTA update path.
+
+make      - build a delta between the running (base) and the new (target) firmware image
+apply     - rebuild the target image from the base and the delta
+simulate  - emulate the indoor unit sending the delta in chunks over many wakes, with packet loss and the
+            same per-wake flash budget and resume rules as OtaUpdater, and verify the rebuilt image
+"""
+
+import argparse
+import hashlib
+import hmac
+import random
+import struct
+import sys
+
+COPY_RUNNING = 0x00
+INSERT = 0x01
+COPY_TARGET = 0x02
+
+BLOCK = 16
+MIN_MATCH = 24
+DIGEST_SIZE = 32
+CHUNK_SIZE = 200
+CHUNKS_PER_WAKE = 4
+FLASH_BUDGET_PER_WAKE = 16 * 1024
+DIGEST_BYTES_PER_WAKE = 64 * 1024
+OFFER_FORMAT = '<IIIIH32s32s'
+OFFER_TAG_SIZE = 16
+OFFER_MAGIC = 0x4f41544f
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7f
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def index_blocks(data, step, index=None, start=0):
+    index = {} if index is None else index
+    for offset in range(start - start % step, len(data) - BLOCK + 1, step):
+        index.setdefault(data[offset:offset + BLOCK], offset)
+    return index
+
+
+def match_length(source, source_offset, target, target_offset, limit):
+    length = 0
+    while (length < limit and source_offset + length < len(source)
+           and target[target_offset + length] == source[source_offset + length]):
+        length += 1
+    return length
+
+
+def make_delta(base, target):
+    base_index = index_blocks(base, 4)
+    target_index = {}
+    indexed_up_to = 0
+    delta = bytearray()
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            delta.extend(bytes([INSERT]) + varint(len(literal)) + literal)
+            literal.clear()
+
+    position = 0
+    while position < len(target):
+        best = (0, None, None)
+        if position + BLOCK <= len(target):
+            block = target[position:position + BLOCK]
+            candidates = [(COPY_RUNNING, base, base_index.get(block))]
+            # back references may only point to the already written part of the target
+            for offset in range(indexed_up_to, position - BLOCK + 1):
+                target_index.setdefault(target[offset:offset + BLOCK], offset)
+            indexed_up_to = max(indexed_up_to, position - BLOCK + 1)
+            candidates.append((COPY_TARGET, target, target_index.get(block)))
+            for opcode, source, offset in candidates:
+                if offset is None:
+                    continue
+                limit = len(target) - position
+                if opcode == COPY_TARGET:
+                    limit = min(limit, position - offset)
+                length = match_length(source, offset, target, position, limit)
+                if length > best[0]:
+                    best = (length, opcode, offset)
+        length, opcode, offset = best
+        if length >= MIN_MATCH:
+            flush_literal()
+            delta.extend(bytes([opcode]) + varint(offset) + varint(length))
+            position += length
+        else:
+            literal.append(target[position])
+            position += 1
+    flush_literal()
+    return bytes(delta)
+
+
+class Decoder:
+    """Mirror of the OtaUpdater decoder including budget suspension."""
+
+    def __init__(self, base, image_size):
+        self.base = base
+        self.image = bytearray()
+        self.image_size = image_size
+        self.phase = 'opcode'
+        self.source = None
+        self.value = 0
+        self.shift = 0
+        self.offset = 0
+        self.remaining = 0
+
+    def read_varint(self, byte):
+        self.value |= (byte & 0x7f) << self.shift
+        self.shift += 7
+        if self.shift > 35:
+            raise ValueError('varint overflow')
+        return not byte & 0x80
+
+    def write(self, data):
+        if len(self.image) + len(data) > self.image_size:
+            raise ValueError('image size exceeded')
+        self.image.extend(data)
+
+    def drain_copy(self, budget):
+        source = self.base if self.source == COPY_RUNNING else self.image
+        size = min(self.remaining, budget)
+        self.write(bytes(source[self.offset:self.offset + size]))
+        self.offset += size
+        self.remaining -= size
+        if self.remaining == 0:
+            self.phase = 'opcode'
+        return size
+
+    def consume(self, data, budget):
+        """Returns (consumed bytes, budget left, chunk completed)."""
+        consumed = 0
+        while consumed < len(data):
+            if self.phase == 'copy':
+                budget -= self.drain_copy(budget)
+                if self.phase == 'copy':
+                    return consumed, budget, False
+                continue
+            if self.phase == 'insert-data':
+                size = min(len(data) - consumed, self.remaining, budget)
+                if size == 0:
+                    return consumed, budget, False
+                self.write(data[consumed:consumed + size])
+                consumed += size
+                budget -= size
+                self.remaining -= size
+                if self.remaining == 0:
+                    self.phase = 'opcode'
+                continue
+            byte = data[consumed]
+            consumed += 1
+            if self.phase == 'opcode':
+                self.value, self.shift = 0, 0
+                if byte in (COPY_RUNNING, COPY_TARGET):
+                    self.source = byte
+                    self.phase = 'source-offset'
+                elif byte == INSERT:
+                    self.phase = 'insert-length'
+                else:
+                    raise ValueError('unknown opcode %d' % byte)
+            elif self.phase == 'source-offset':
+                if self.read_varint(byte):
+                    self.offset, self.value, self.shift = self.value, 0, 0
+                    self.phase = 'source-length'
+            elif self.phase == 'source-length':
+                if self.read_varint(byte):
+                    self.remaining = self.value
+                    limit = len(self.base) if self.source == COPY_RUNNING else len(self.image)
+                    if self.offset + self.remaining > limit:
+                        raise ValueError('copy source is out of range')
+                    self.phase = 'copy' if self.remaining else 'opcode'
+            elif self.phase == 'insert-length':
+                if self.read_varint(byte):
+                    self.remaining = self.value
+                    self.phase = 'insert-data' if self.remaining else 'opcode'
+        return consumed, budget, True
+
+
+def apply_delta(base, delta, image_size):
+    decoder = Decoder(base, image_size)
+    consumed, _, _ = decoder.consume(delta, len(delta) + image_size)
+    while decoder.phase == 'copy':
+        decoder.drain_copy(image_size)
+    if consumed != len(delta):
+        raise ValueError('delta is truncated')
+    return bytes(decoder.image)
+
+
+def image_digest(image):
+    return image[-DIGEST_SIZE:]
+
+
+def simulate(base, target, delta, loss, seed):
+    rng = random.Random(seed)
+    decoder = Decoder(base, len(target))
+    chunks = [delta[offset:offset + CHUNK_SIZE] for offset in range(0, len(delta), CHUNK_SIZE)]
+    next_chunk, chunk_consumed = 0, 0
+    wakes, packets, radio_bytes = 0, 0, 0
+    request_size, chunk_message_size = 14, 214
+    while next_chunk < len(chunks) or decoder.phase == 'copy':
+        wakes += 1
+        budget = FLASH_BUDGET_PER_WAKE
+        if decoder.phase == 'copy':
+            budget -= decoder.drain_copy(budget)
+            if decoder.phase == 'copy':
+                continue
+        if next_chunk >= len(chunks):
+            continue
+        count = min(CHUNKS_PER_WAKE, len(chunks) - next_chunk)
+        packets += 1
+        radio_bytes += request_size
+        received = 0
+        for _ in range(count):
+            packets += 1
+            radio_bytes += chunk_message_size
+            if rng.random() < loss:
+                break
+            received += 1
+        for index in range(next_chunk, next_chunk + received):
+            consumed, budget, done = decoder.consume(chunks[index][chunk_consumed:], budget)
+            chunk_consumed += consumed
+            if not done:
+                break
+            next_chunk += 1
+            chunk_consumed = 0
+    # The digest starts in the wake applying the last chunk and goes on in the next ones
+    wakes += (len(target) - DIGEST_SIZE - 1) // DIGEST_BYTES_PER_WAKE
+    rebuilt = bytes(decoder.image)
+    digest_ok = hashlib.sha256(rebuilt[:-DIGEST_SIZE]).digest() == image_digest(target)
+    return {
+        'wakes': wakes,
+        'packets': packets,
+        'radio_bytes': radio_bytes,
+        'image_ok': rebuilt == target,
+        'digest_ok': digest_ok,
+    }
+
+
+def read(path):
+    with open(path, 'rb') as file:
+        return file.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+    make = commands.add_parser('make')
+    make.add_argument('base')
+    make.add_argument('target')
+    make.add_argument('delta')
+    make.add_argument('--session', type=lambda value: int(value, 0), default=1)
+    make.add_argument('--key', type=bytes.fromhex, required=True, help='AppConfig::preSharedKey as 64 hex digits')
+    apply = commands.add_parser('apply')
+    apply.add_argument('base')
+    apply.add_argument('delta')
+    apply.add_argument('output')
+    apply.add_argument('--size', type=int, required=True)
+    sim = commands.add_parser('simulate')
+    sim.add_argument('base')
+    sim.add_argument('target')
+    sim.add_argument('--loss', type=float, default=0.05)
+    sim.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    if args.command == 'make':
+        base, target = read(args.base), read(args.target)
+        delta = make_delta(base, target)
+        if apply_delta(base, delta, len(target)) != target:
+            sys.exit('delta verification failed')
+        with open(args.delta, 'wb') as file:
+            file.write(delta)
+        if len(args.key) != 32 or not any(args.key):
+            sys.exit('the pre-shared key has to be 32 bytes, not all zeros')
+        offer = struct.pack(OFFER_FORMAT, OFFER_MAGIC, args.session, len(delta), len(target), CHUNK_SIZE,
+                            image_digest(base), image_digest(target))
+        offer += hmac.new(args.key, b'OTA' + offer, hashlib.sha256).digest()[:OFFER_TAG_SIZE]
+        print('delta: %d bytes (%.1f%% of the image), %d chunks' %
+              (len(delta), 100.0 * len(delta) / len(target), (len(delta) + CHUNK_SIZE - 1) // CHUNK_SIZE))
+        print('offer: %s' % offer.hex())
+    elif args.command == 'apply':
+        image = apply_delta(read(args.base), read(args.delta), args.size)
+        with open(args.output, 'wb') as file:
+            file.write(image)
+    else:
+        base, target = read(args.base), read(args.target)
+        delta = make_delta(base, target)
+        result = simulate(base, target, delta, args.loss, args.seed)
+        print('delta %d bytes, %d wakes, %d packets, %d radio bytes, image %s, digest %s' % (
+            len(delta), result['wakes'], result['packets'], result['radio_bytes'],
+            'ok' if result['image_ok'] else 'MISMATCH', 'ok' if result['digest_ok'] else 'MISMATCH'))
+        if not (result['image_ok'] and result['digest_ok']):
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
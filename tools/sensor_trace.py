@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Host side of the sensor trace (main/SensorTrace.h).
+
+extract - collect the records of the "STRC <hex>" lines of a serial capture into a trace file
+csv     - print the records of a trace file as CSV in physical units
+"""
+
+import argparse
+import struct
+import sys
+
+RECORD = struct.Struct('<IHBBiii')
+KINDS = {0: 'dropped', 1: 'pth', 2: 'pm', 3: 'battery', 4: 'link'}
+LINK_OUTCOMES = {0: 'lost', 1: 'acknowledged', 2: 'completed'}
+
+
+def extract(lines):
+    data = bytearray()
+    for line in lines:
+        position = line.find('STRC ')
+        if position < 0:
+            continue
+        chunk = bytes.fromhex(line[position + 5:].strip())
+        if len(chunk) % RECORD.size:
+            sys.stderr.write('skipping a truncated line\n')
+            continue
+        data += chunk
+    return bytes(data)
+
+
+def records(data):
+    for offset in range(0, len(data) - len(data) % RECORD.size, RECORD.size):
+        yield RECORD.unpack_from(data, offset)
+
+
+def to_row(record):
+    seconds, milliseconds, kind, status, first, second, third = record
+    timestamp = '%d.%03d' % (seconds, milliseconds)
+    name = KINDS.get(kind, 'unknown')
+    if name == 'pth':
+        return [timestamp, name, status, first / 100, second / 256, third / 1024]
+    if name == 'link':
+        return [timestamp, name, LINK_OUTCOMES.get(status, status), first, second, third]
+    if name == 'battery':
+        return [timestamp, name, status, first, '', '']
+    return [timestamp, name, status, first, second, third]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+    extract_command = commands.add_parser('extract')
+    extract_command.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    extract_command.add_argument('-o', '--output', required=True)
+    csv_command = commands.add_parser('csv')
+    csv_command.add_argument('trace')
+    args = parser.parse_args()
+
+    if args.command == 'extract':
+        data = extract(args.log)
+        with open(args.output, 'wb') as output:
+            output.write(data)
+        print('%d records' % (len(data) // RECORD.size))
+    else:
+        with open(args.trace, 'rb') as trace:
+            data = trace.read()
+        # pth: temperature C, pressure Pa, humidity %; pm: ug/m3; battery: raw ADC; link: sequence, attempts, route
+        print('timestamp,kind,status,value1,value2,value3')
+        for record in records(data):
+            print(','.join(str(value) for value in to_row(record)))
+
+
+if __name__ == '__main__':
+    main()